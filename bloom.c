@@ -0,0 +1,103 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bloom.h"
+
+/* Mixes the bits of the key (the finalizer of
+ * MurmurHash3), so that close keys, such as
+ * sequential ids, spread over the whole filter.
+ */
+static uint64_t hash_key(int key)
+{
+  uint64_t h = (uint64_t)(uint32_t)key;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+/* Creates an empty filter sized for capacity keys.
+ */
+bloom *bloom_create(int capacity)
+{
+  bloom *filter = malloc(sizeof(bloom));
+  if (filter == NULL)
+  {
+    perror("Bloom filter creation.");
+    exit(EXIT_FAILURE);
+  }
+  if (capacity < BLOOM_MIN_CAPACITY)
+    capacity = BLOOM_MIN_CAPACITY;
+  filter->capacity = capacity;
+  filter->num_keys = 0;
+  filter->num_blocks = (int)(((long)capacity * BLOOM_BITS_PER_KEY +
+                              BLOOM_BLOCK_WORDS * 64 - 1) /
+                             (BLOOM_BLOCK_WORDS * 64));
+  filter->blocks = calloc((size_t)filter->num_blocks * BLOOM_BLOCK_WORDS,
+                          sizeof(uint64_t));
+  if (filter->blocks == NULL)
+  {
+    perror("Bloom filter blocks.");
+    exit(EXIT_FAILURE);
+  }
+  return filter;
+}
+
+void bloom_destroy(bloom *filter)
+{
+  free(filter->blocks);
+  free(filter);
+}
+
+/* Returns the block holding the bits of a key.
+ */
+int bloom_block_of(bloom *filter, int key)
+{
+  return (int)((hash_key(key) >> 32) % (uint64_t)filter->num_blocks);
+}
+
+/* The BLOOM_HASHES bit positions of a key inside
+ * its block, taken 9 bits at a time from the low
+ * half of the hash and a second round of mixing.
+ */
+static void bit_positions(int key, int positions[])
+{
+  uint64_t h = hash_key(key);
+  uint64_t bits = (h & 0xffffffffULL) | (hash_key((int)(h >> 32) ^ key) << 32);
+  int i;
+  for (i = 0; i < BLOOM_HASHES; i++)
+  {
+    positions[i] = (int)(bits & (BLOOM_BLOCK_WORDS * 64 - 1));
+    bits >>= 9;
+  }
+}
+
+void bloom_add(bloom *filter, int key)
+{
+  uint64_t *block = filter->blocks +
+                    (size_t)bloom_block_of(filter, key) * BLOOM_BLOCK_WORDS;
+  int positions[BLOOM_HASHES], i;
+  bit_positions(key, positions);
+  for (i = 0; i < BLOOM_HASHES; i++)
+    block[positions[i] / 64] |= (uint64_t)1 << (positions[i] % 64);
+  filter->num_keys++;
+}
+
+/* Returns false if the key was never added, and
+ * true if it may have been.
+ */
+bool bloom_may_contain(bloom *filter, int key)
+{
+  uint64_t *block = filter->blocks +
+                    (size_t)bloom_block_of(filter, key) * BLOOM_BLOCK_WORDS;
+  int positions[BLOOM_HASHES], i;
+  bool found = true;
+  bit_positions(key, positions);
+  for (i = 0; i < BLOOM_HASHES; i++)
+    found &= (block[positions[i] / 64] >> (positions[i] % 64)) & 1;
+  return found;
+}
@@ -0,0 +1,54 @@
+/*
+ *  bloom.h
+ *
+ *  Blocked Bloom filter over int keys, used to
+ *  answer "definitely not present" without
+ *  searching the B+ tree.
+ *
+ *  The filter is an array of blocks of one cache
+ *  line (512 bits).  A key selects one block and
+ *  sets BLOOM_HASHES bits inside it, so adding or
+ *  testing a key touches a single cache line.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Bits of filter per key it is sized for
+// (about 1% false positives).
+#define BLOOM_BITS_PER_KEY 10
+
+// Bits set per key inside its block.
+#define BLOOM_HASHES 6
+
+// Words of 64 bits in a block of one cache line.
+#define BLOOM_BLOCK_WORDS 8
+
+// Smallest number of keys a filter is sized for.
+#define BLOOM_MIN_CAPACITY 1024
+
+// TYPES.
+
+/* Type representing the filter.  capacity is
+ * the number of keys it was sized for; once
+ * num_keys goes past it the false positive
+ * rate grows and the filter should be rebuilt
+ * larger.
+ */
+typedef struct bloom
+{
+  int num_blocks;
+  int capacity;
+  int num_keys;
+  uint64_t *blocks;
+} bloom;
+
+// FUNCTION PROTOTYPES.
+
+bloom *bloom_create(int capacity);
+void bloom_destroy(bloom *filter);
+int bloom_block_of(bloom *filter, int key);
+void bloom_add(bloom *filter, int key);
+bool bloom_may_contain(bloom *filter, int key);
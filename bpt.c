@@ -1,23 +1,38 @@
+#define _POSIX_C_SOURCE 200112L
+
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 
 #include "bpt.h"
 
-// GLOBALS.
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* Nodes are searched with a branchless binary
+ * search until at most this many keys are left,
+ * which are then compared all at once.
+ */
+#define SEARCH_WINDOW 16
 
-/* The order determines the maximum and minimum
- * number of entries (keys and pointers) in any
- * node.  Every node has at most order - 1 keys and
- * at least (roughly speaking) half that number.
- * Every leaf has as many pointers to data as keys,
- * and every internal node has one more pointer
- * to a subtree than the number of keys.
- * This global variable is initialized to the
- * default value.
+/* Number of lookups find_many advances in
+ * lockstep, so that the memory accesses of one
+ * level overlap instead of waiting on each other.
  */
-int order = DEFAULT_ORDER;
+#define FIND_GROUP 16
+
+#if defined(__GNUC__)
+#define PREFETCH(address) __builtin_prefetch(address)
+#else
+#define PREFETCH(address)
+#endif
+
+// GLOBALS.
 
 /* The queue is used to print the tree in
  * level order, starting from the root
@@ -33,9 +48,98 @@ node *queue = NULL;
  */
 bool verbose_output = false;
 
+/* Nodes changed since they were last written
+ * to disk, chained through next_dirty, so the
+ * caller can persist only the pages touched
+ * by an insertion.
+ */
+node *dirty_nodes = NULL;
+
+/* Number of nodes in memory, over all trees.
+ */
+long live_nodes = 0;
+
+/* Reads the child stored in a page of the index
+ * file, for a parent that only holds its page.
+ * Set by the caller before any child is unloaded.
+ */
+node *(*load_node)(node *parent, int page) = NULL;
+
 
 // FUNCTION DEFINITIONS.
 
+/* Counts how many of the n keys are smaller than
+ * key, comparing 8 keys at a time with AVX2 or 4
+ * at a time with SSE2 when the compiler targets
+ * them, without branching on the keys.
+ */
+static int count_below(const int *keys, int n, int key)
+{
+  int i = 0, count = 0;
+#if defined(__AVX2__)
+  __m256i k8 = _mm256_set1_epi32(key);
+  __m256i acc8 = _mm256_setzero_si256();
+  for (; i + 8 <= n; i += 8)
+  {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(keys + i));
+    acc8 = _mm256_sub_epi32(acc8, _mm256_cmpgt_epi32(k8, v));
+  }
+  __m128i acc = _mm_add_epi32(_mm256_castsi256_si128(acc8),
+                              _mm256_extracti128_si256(acc8, 1));
+#elif defined(__SSE2__)
+  __m128i acc = _mm_setzero_si128();
+#endif
+#if defined(__AVX2__) || defined(__SSE2__)
+  /* Each lane that compares true is -1, so
+   * subtracting the masks counts the keys.
+   */
+  __m128i k4 = _mm_set1_epi32(key);
+  for (; i + 4 <= n; i += 4)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i *)(keys + i));
+    acc = _mm_sub_epi32(acc, _mm_cmplt_epi32(v, k4));
+  }
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+  count = _mm_cvtsi128_si32(acc);
+#endif
+  for (; i < n; i++)
+    count += keys[i] < key;
+  return count;
+}
+
+/* Returns the number of keys in the sorted array
+ * that are smaller than key, which is the position
+ * where key is or would be inserted.
+ * Large nodes are narrowed down with a branchless
+ * binary search before counting the last window.
+ */
+static int lower_bound(const int *keys, int n, int key)
+{
+  const int *base = keys;
+  int half;
+  while (n > SEARCH_WINDOW)
+  {
+    half = n / 2;
+    base = base[half - 1] < key ? base + half : base;
+    n -= half;
+  }
+  return (int)(base - keys) + count_below(base, n, key);
+}
+
+/* Returns the number of keys in the sorted array
+ * that are smaller than or equal to key, which is
+ * the child to follow in an internal node.
+ */
+static int upper_bound(const int *keys, int n, int key)
+{
+  if (key == INT_MAX)
+    return n;
+  return lower_bound(keys, n, key + 1);
+}
+
+static bool on_right_spine(node *n);
+
 /* Finds keys and their pointers, if present, in the range specified
  * by key_start and key_end, inclusive.  Places these in the arrays
  * returned_keys and returned_pointers, and returns the number of
@@ -49,19 +153,25 @@ int find_range(node *const root, int key_start, int key_end, bool verbose,
   node *n = find_leaf(root, key_start, verbose);
   if (n == NULL)
     return 0;
-  for (i = 0; i < n->num_keys && n->keys[i] < key_start; i++)
-    ;
+  i = lower_bound(n->keys, n->num_keys, key_start);
   if (i == n->num_keys)
     return 0;
-  while (n != NULL)
+  for (;;)
   {
     for (; i < n->num_keys && n->keys[i] <= key_end; i++)
     {
       returned_keys[num_found] = n->keys[i];
-      returned_pointers[num_found] = n->pointers[i];
+      returned_pointers[num_found] = &n->records[i];
       num_found++;
     }
-    n = n->pointers[order - 1];
+
+    /* The next leaf is found from the root, so that
+     * leaves that are not in memory are read.
+     */
+    if (i < n->num_keys || n->keys[i - 1] >= key_end ||
+        on_right_spine(n))
+      break;
+    n = find_leaf(root, n->keys[i - 1] + 1, false);
     i = 0;
   }
   return num_found;
@@ -91,17 +201,10 @@ node *find_leaf(node *const root, int key, bool verbose)
         printf("%d ", c->keys[i]);
       printf("%d] ", c->keys[i]);
     }
-    i = 0;
-    while (i < c->num_keys)
-    {
-      if (key >= c->keys[i])
-        i++;
-      else
-        break;
-    }
+    i = upper_bound(c->keys, c->num_keys, key);
     if (verbose)
       printf("%d ->\n", i);
-    c = (node *)c->pointers[i];
+    c = get_child(c, i);
   }
   if (verbose)
   {
@@ -138,17 +241,107 @@ record *find(node *root, int key, bool verbose, node **leaf_out)
      * include the desired key.) 
      */
 
-  for (i = 0; i < leaf->num_keys; i++)
-    if (leaf->keys[i] == key)
-      break;
+  i = lower_bound(leaf->keys, leaf->num_keys, key);
   if (leaf_out != NULL)
   {
     *leaf_out = leaf;
   }
-  if (i == leaf->num_keys)
+  if (i == leaf->num_keys || leaf->keys[i] != key)
     return NULL;
   else
-    return (record *)leaf->pointers[i];
+    return &leaf->records[i];
+}
+
+/* Finds the records of many keys at once,
+ * placing in out[i] the record of keys[i], or
+ * NULL if it is not in the tree.
+ * The keys are looked up in groups of FIND_GROUP
+ * that descend one level at a time together:
+ * while a level is searched for every key of the
+ * group, the nodes chosen for the next level are
+ * prefetched, so their cache misses overlap
+ * instead of being paid one after the other.
+ */
+void find_many(node *const root, const int keys[], int num_keys,
+               record *out[])
+{
+  node *current[FIND_GROUP];
+  node *c;
+  int base, group, i, j;
+
+  for (base = 0; base < num_keys; base += FIND_GROUP)
+  {
+    group = num_keys - base < FIND_GROUP ? num_keys - base : FIND_GROUP;
+
+    if (root == NULL)
+    {
+      for (j = 0; j < group; j++)
+        out[base + j] = NULL;
+      continue;
+    }
+
+    for (j = 0; j < group; j++)
+      current[j] = root;
+
+    /* All the leaves are at the same depth, so the
+     * whole group reaches them in the same step.
+     */
+    while (!current[0]->is_leaf)
+    {
+      for (j = 0; j < group; j++)
+      {
+        c = current[j];
+        i = upper_bound(c->keys, c->num_keys, keys[base + j]);
+        current[j] = get_child(c, i);
+        PREFETCH(current[j]);
+        PREFETCH(&current[j]->keys[(c->order - 1) / 2]);
+      }
+    }
+
+    for (j = 0; j < group; j++)
+    {
+      c = current[j];
+      i = lower_bound(c->keys, c->num_keys, keys[base + j]);
+      out[base + j] = i < c->num_keys && c->keys[i] == keys[base + j]
+                          ? &c->records[i]
+                          : NULL;
+    }
+  }
+}
+
+/* Returns the child i of an internal node,
+ * reading it first if it is not in memory.
+ */
+node *get_child(node *n, int i)
+{
+  node *c = n->pointers[i];
+  if (UNLOADED(c))
+  {
+    c = load_node(n, UNLOADED_PAGE(c));
+    c->parent = n;
+    c->owner = n->owner;
+    n->pointers[i] = c;
+  }
+  return c;
+}
+
+/* Frees the subtree of child i of n, leaving in
+ * n the page of the child, to be read again when
+ * visited.  Every node of the subtree must have
+ * been written and be clean.
+ */
+void unload_child(node *n, int i)
+{
+  node *c = n->pointers[i];
+  int j;
+  if (UNLOADED(c))
+    return;
+  if (!c->is_leaf)
+    for (j = 0; j <= c->num_keys; j++)
+      unload_child(c, j);
+  n->pointers[i] = UNLOADED_CHILD(c->disk_page);
+  free(c);
+  live_nodes--;
 }
 
 /* Finds the appropriate place to
@@ -162,68 +355,142 @@ int cut(int length)
     return length / 2 + 1;
 }
 
-// INSERTION
+/* Adds a node to the list of nodes that
+ * must be written back to disk.
+ */
+void mark_dirty(node *n)
+{
+  if (n->dirty)
+    return;
+  n->dirty = true;
+  n->next_dirty = dirty_nodes;
+  dirty_nodes = n;
+}
 
-/* Creates a new record to hold the value
- * to which a key refers.
+/* Empties the list of dirty nodes, once
+ * the caller has written them back.
  */
-record *make_record(int page, int offset)
+void clean_dirty_nodes(void)
 {
-  record *new_record = (record *)malloc(sizeof(record));
-  if (new_record == NULL)
+  node *n;
+  while (dirty_nodes != NULL)
   {
-    perror("Record creation.");
-    exit(EXIT_FAILURE);
+    n = dirty_nodes;
+    dirty_nodes = n->next_dirty;
+    n->dirty = false;
+    n->next_dirty = NULL;
   }
-  else
-  {
-    new_record->page = page;
-    new_record->offset = offset;
-  }
-  return new_record;
+}
+
+// INSERTION
+
+/* Size in bytes of the keys array of a node,
+ * rounded so that the area after it is
+ * aligned for pointers.
+ */
+static size_t keys_size(int order)
+{
+  size_t size = (order - 1) * sizeof(int);
+  return (size + sizeof(void *) - 1) / sizeof(void *) * sizeof(void *);
+}
+
+/* Size in bytes of a node of the given order:
+ * the header, the keys and the larger of the
+ * leaf records and the internal pointers,
+ * rounded up to a whole number of cache lines.
+ */
+size_t node_size(int order)
+{
+  size_t records = (order - 1) * sizeof(record);
+  size_t pointers = order * sizeof(node *);
+  size_t size = sizeof(node) + keys_size(order) +
+                (records > pointers ? records : pointers);
+  return (size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+}
+
+/* Returns the largest order whose nodes fit in
+ * size bytes (a multiple of the cache line or a
+ * 4 or 8 KB page, for instance), within
+ * MIN_ORDER and MAX_ORDER.
+ */
+int order_for_node_size(size_t size)
+{
+  int order = MIN_ORDER;
+  while (order < MAX_ORDER && node_size(order + 1) <= size)
+    order++;
+  return order;
 }
 
 /* Creates a new general node, which can be adapted
  * to serve as either a leaf or an internal node.
+ * The node, its keys and its records or pointers
+ * are a single cache-line-aligned allocation.
  */
-node *make_node(void)
+node *make_node(int order)
 {
   node *new_node;
-  new_node = malloc(sizeof(node));
-  if (new_node == NULL)
+  void *area;
+  if (posix_memalign((void **)&new_node, CACHE_LINE, node_size(order)) != 0)
   {
     perror("Node creation.");
     exit(EXIT_FAILURE);
   }
-  new_node->keys = malloc((order - 1) * sizeof(int));
-  if (new_node->keys == NULL)
-  {
-    perror("New node keys array.");
-    exit(EXIT_FAILURE);
-  }
-  new_node->pointers = malloc(order * sizeof(void *));
-  if (new_node->pointers == NULL)
-  {
-    perror("New node pointers array.");
-    exit(EXIT_FAILURE);
-  }
+  area = (char *)new_node->keys + keys_size(order);
+  new_node->order = order;
+  new_node->pointers = area;
+  new_node->records = area;
+  new_node->owner = NULL;
   new_node->is_leaf = false;
   new_node->num_keys = 0;
   new_node->parent = NULL;
   new_node->next = NULL;
+  new_node->disk_page = 0;
+  new_node->dirty = false;
+  new_node->next_dirty = NULL;
+  mark_dirty(new_node);
+  live_nodes++;
   return new_node;
 }
 
 /* Creates a new leaf by creating a node
  * and then adapting it appropriately.
  */
-node *make_leaf(void)
+node *make_leaf(int order)
 {
-  node *leaf = make_node();
+  node *leaf = make_node(order);
   leaf->is_leaf = true;
   return leaf;
 }
 
+/* Returns true if the node is the last one of
+ * its level, that is, every node on the path
+ * from the root to it is the rightmost child
+ * of its parent.
+ */
+static bool on_right_spine(node *n)
+{
+  while (n->parent != NULL)
+  {
+    if (n->parent->pointers[n->parent->num_keys] != n)
+      return false;
+    n = n->parent;
+  }
+  return true;
+}
+
+/* Returns the rightmost leaf of the tree,
+ * following the last pointer of each node.
+ */
+node *rightmost_leaf(node *const root)
+{
+  node *c = root;
+  if (c == NULL)
+    return NULL;
+  while (!c->is_leaf)
+    c = get_child(c, c->num_keys);
+  return c;
+}
+
 /* Helper function used in insert_into_parent
  * to find the index of the parent's pointer to 
  * the node to the left of the key to be inserted.
@@ -247,18 +514,17 @@ node *insert_into_leaf(node *leaf, int key, record *pointer)
 
   int i, insertion_point;
 
-  insertion_point = 0;
-  while (insertion_point < leaf->num_keys && leaf->keys[insertion_point] < key)
-    insertion_point++;
+  insertion_point = lower_bound(leaf->keys, leaf->num_keys, key);
 
   for (i = leaf->num_keys; i > insertion_point; i--)
   {
     leaf->keys[i] = leaf->keys[i - 1];
-    leaf->pointers[i] = leaf->pointers[i - 1];
+    leaf->records[i] = leaf->records[i - 1];
   }
   leaf->keys[insertion_point] = key;
-  leaf->pointers[insertion_point] = pointer;
+  leaf->records[insertion_point] = *pointer;
   leaf->num_keys++;
+  mark_dirty(leaf);
   return leaf;
 }
 
@@ -272,10 +538,11 @@ node *insert_into_leaf_after_splitting(node *root, node *leaf, int key, record *
 
   node *new_leaf;
   int *temp_keys;
-  void **temp_pointers;
+  record *temp_records;
   int insertion_index, split, new_key, i, j;
+  int order = leaf->order;
 
-  new_leaf = make_leaf();
+  new_leaf = make_leaf(order);
 
   temp_keys = malloc(order * sizeof(int));
   if (temp_keys == NULL)
@@ -284,59 +551,59 @@ node *insert_into_leaf_after_splitting(node *root, node *leaf, int key, record *
     exit(EXIT_FAILURE);
   }
 
-  temp_pointers = malloc(order * sizeof(void *));
-  if (temp_pointers == NULL)
+  temp_records = malloc(order * sizeof(record));
+  if (temp_records == NULL)
   {
-    perror("Temporary pointers array.");
+    perror("Temporary records array.");
     exit(EXIT_FAILURE);
   }
 
-  insertion_index = 0;
-  while (insertion_index < order - 1 && leaf->keys[insertion_index] < key)
-    insertion_index++;
+  insertion_index = lower_bound(leaf->keys, order - 1, key);
 
   for (i = 0, j = 0; i < leaf->num_keys; i++, j++)
   {
     if (j == insertion_index)
       j++;
     temp_keys[j] = leaf->keys[i];
-    temp_pointers[j] = leaf->pointers[i];
+    temp_records[j] = leaf->records[i];
   }
 
   temp_keys[insertion_index] = key;
-  temp_pointers[insertion_index] = pointer;
+  temp_records[insertion_index] = *pointer;
 
   leaf->num_keys = 0;
 
-  split = cut(order - 1);
+  /* A key appended after the last key of the
+   * rightmost leaf (an increasing key, such as
+   * an auto increment) starts a new leaf instead
+   * of splitting in half, so full leaves stay full.
+   */
+  if (insertion_index == order - 1 && on_right_spine(leaf))
+    split = order - 1;
+  else
+    split = cut(order - 1);
 
   for (i = 0; i < split; i++)
   {
-    leaf->pointers[i] = temp_pointers[i];
+    leaf->records[i] = temp_records[i];
     leaf->keys[i] = temp_keys[i];
     leaf->num_keys++;
   }
 
   for (i = split, j = 0; i < order; i++, j++)
   {
-    new_leaf->pointers[j] = temp_pointers[i];
+    new_leaf->records[j] = temp_records[i];
     new_leaf->keys[j] = temp_keys[i];
     new_leaf->num_keys++;
   }
 
-  free(temp_pointers);
+  free(temp_records);
   free(temp_keys);
 
-  new_leaf->pointers[order - 1] = leaf->pointers[order - 1];
-  leaf->pointers[order - 1] = new_leaf;
-
-  for (i = leaf->num_keys; i < order - 1; i++)
-    leaf->pointers[i] = NULL;
-  for (i = new_leaf->num_keys; i < order - 1; i++)
-    new_leaf->pointers[i] = NULL;
-
   new_leaf->parent = leaf->parent;
+  new_leaf->owner = leaf->owner;
   new_key = new_leaf->keys[0];
+  mark_dirty(leaf);
 
   return insert_into_parent(root, leaf, new_key, new_leaf);
 }
@@ -358,6 +625,7 @@ node *insert_into_node(node *root, node *n,
   n->pointers[left_index + 1] = right;
   n->keys[left_index] = key;
   n->num_keys++;
+  mark_dirty(n);
   return root;
 }
 
@@ -373,6 +641,7 @@ node *insert_into_node_after_splitting(node *root, node *old_node, int left_inde
   node *new_node, *child;
   int *temp_keys;
   node **temp_pointers;
+  int order = old_node->order;
 
   /* First create a temporary set of keys and pointers
 	 * to hold everything in order, including
@@ -416,9 +685,17 @@ node *insert_into_node_after_splitting(node *root, node *old_node, int left_inde
   /* Create the new node and copy
 	 * half the keys and pointers to the
 	 * old and half to the new.
+	 * As with leaves, a pointer appended to the
+	 * last node of its level leaves the old node
+	 * nearly full: the new node takes only the last
+	 * key and its two pointers, never a single
+	 * pointer without keys.
 	 */
-  split = cut(order);
-  new_node = make_node();
+  if (left_index == order - 1 && on_right_spine(old_node))
+    split = order - 1;
+  else
+    split = cut(order);
+  new_node = make_node(order);
   old_node->num_keys = 0;
   for (i = 0; i < split - 1; i++)
   {
@@ -438,10 +715,13 @@ node *insert_into_node_after_splitting(node *root, node *old_node, int left_inde
   free(temp_pointers);
   free(temp_keys);
   new_node->parent = old_node->parent;
+  new_node->owner = old_node->owner;
+  mark_dirty(old_node);
   for (i = 0; i <= new_node->num_keys; i++)
   {
     child = new_node->pointers[i];
-    child->parent = new_node;
+    if (!UNLOADED(child))
+      child->parent = new_node;
   }
 
   /* Insert a new key into the parent of the two
@@ -481,7 +761,7 @@ node *insert_into_parent(node *root, node *left, int key, node *right)
   /* Simple case: the new key fits into the node. 
 	 */
 
-  if (parent->num_keys < order - 1)
+  if (parent->num_keys < parent->order - 1)
     return insert_into_node(root, parent, left_index, key, right);
 
   /* Harder case:  split a node in order 
@@ -498,12 +778,13 @@ node *insert_into_parent(node *root, node *left, int key, node *right)
 node *insert_into_new_root(node *left, int key, node *right)
 {
 
-  node *root = make_node();
+  node *root = make_node(left->order);
   root->keys[0] = key;
   root->pointers[0] = left;
   root->pointers[1] = right;
   root->num_keys++;
   root->parent = NULL;
+  root->owner = left->owner;
   left->parent = root;
   right->parent = root;
   return root;
@@ -512,13 +793,12 @@ node *insert_into_new_root(node *left, int key, node *right)
 /* First insertion:
  * start a new tree.
  */
-node *start_new_tree(int key, record *pointer)
+node *start_new_tree(int order, int key, record *pointer)
 {
 
-  node *root = make_leaf();
+  node *root = make_leaf(order);
   root->keys[0] = key;
-  root->pointers[0] = pointer;
-  root->pointers[order - 1] = NULL;
+  root->records[0] = *pointer;
   root->parent = NULL;
   root->num_keys++;
   return root;
@@ -528,18 +808,20 @@ node *start_new_tree(int key, record *pointer)
  * Inserts a key and an associated value into
  * the B+ tree, causing the tree to be adjusted
  * however necessary to maintain the B+ tree
- * properties.
+ * properties.  The order is only used to start
+ * a new tree; existing nodes keep their own.
  */
-node *insert(node *root, int key, int page, int offset)
+node *insert(node *root, int order, int key, int page, int offset)
 {
   record *record_pointer = NULL;
+  record new_record;
   node *leaf = NULL;
 
   /* The current implementation ignores
 	 * duplicates.
 	 */
 
-  record_pointer = find(root, key, false, NULL);
+  record_pointer = find(root, key, false, &leaf);
   if (record_pointer != NULL)
   {
 
@@ -549,20 +831,23 @@ node *insert(node *root, int key, int page, int offset)
 
     record_pointer->page = page;
     record_pointer->offset = offset;
+    mark_dirty(leaf);
     return root;
   }
 
   /* Create a new record for the
-	 * value.
+	 * value.  It is copied into the leaf.
 	 */
-  record_pointer = make_record(page, offset);
+  new_record.page = page;
+  new_record.offset = offset;
+  record_pointer = &new_record;
 
   /* Case: the tree does not exist yet.
 	 * Start a new tree.
 	 */
 
   if (root == NULL)
-    return start_new_tree(key, record_pointer);
+    return start_new_tree(order, key, record_pointer);
 
   /* Case: the tree already exists.
 	 * (Rest of function body.)
@@ -573,7 +858,7 @@ node *insert(node *root, int key, int page, int offset)
   /* Case: leaf has room for key and record_pointer.
 	 */
 
-  if (leaf->num_keys < order - 1)
+  if (leaf->num_keys < leaf->order - 1)
   {
     leaf = insert_into_leaf(leaf, key, record_pointer);
     return root;
@@ -585,18 +870,390 @@ node *insert(node *root, int key, int page, int offset)
   return insert_into_leaf_after_splitting(root, leaf, key, record_pointer);
 }
 
+// BULK LOADING
+
+/* Prepares a bulk load of a tree of the given
+ * order that fills leaves and
+ * internal nodes up to fill_percent of their
+ * capacity (1 to 100), leaving room for later
+ * insertions without immediate splits.
+ */
+void bulk_load_start(bulk_loader *loader, int order, int fill_percent)
+{
+  if (fill_percent < 1)
+    fill_percent = 1;
+  if (fill_percent > 100)
+    fill_percent = 100;
+
+  loader->nodes = NULL;
+  loader->min_keys = NULL;
+  loader->num_nodes = 0;
+  loader->capacity = 0;
+  loader->last_key = 0;
+  loader->order = order;
+
+  loader->leaf_keys = (order - 1) * fill_percent / 100;
+  if (loader->leaf_keys < 1)
+    loader->leaf_keys = 1;
+
+  /* Internal nodes keep at least two keys so that
+   * spreading the children evenly never leaves a
+   * node with a single child.
+   */
+  loader->node_keys = (order - 1) * fill_percent / 100;
+  if (loader->node_keys < 2)
+    loader->node_keys = 2;
+  if (loader->node_keys > order - 1)
+    loader->node_keys = order - 1;
+}
+
+/* Appends the next key of the sorted stream,
+ * starting a new leaf whenever the current one
+ * reaches the fill target.  Returns false, and
+ * ignores the entry, if the key is not greater
+ * than the previous one.
+ */
+bool bulk_load_add(bulk_loader *loader, int key, int page, int offset)
+{
+  node *leaf = NULL, *new_leaf;
+
+  if (loader->num_nodes > 0)
+  {
+    if (key <= loader->last_key)
+      return false;
+    leaf = loader->nodes[loader->num_nodes - 1];
+  }
+
+  if (leaf == NULL || leaf->num_keys == loader->leaf_keys)
+  {
+    if (loader->num_nodes == loader->capacity)
+    {
+      loader->capacity = loader->capacity == 0 ? 64 : loader->capacity * 2;
+      loader->nodes = realloc(loader->nodes, loader->capacity * sizeof(node *));
+      loader->min_keys = realloc(loader->min_keys, loader->capacity * sizeof(int));
+      if (loader->nodes == NULL || loader->min_keys == NULL)
+      {
+        perror("Bulk load level array.");
+        exit(EXIT_FAILURE);
+      }
+    }
+    new_leaf = make_leaf(loader->order);
+    loader->nodes[loader->num_nodes] = new_leaf;
+    loader->min_keys[loader->num_nodes] = key;
+    loader->num_nodes++;
+    leaf = new_leaf;
+  }
+
+  leaf->keys[leaf->num_keys] = key;
+  leaf->records[leaf->num_keys].page = page;
+  leaf->records[leaf->num_keys].offset = offset;
+  leaf->num_keys++;
+  loader->last_key = key;
+  return true;
+}
+
+/* Builds the internal levels over the leaves,
+ * one level at a time, spreading the children
+ * of each level evenly among the fewest nodes
+ * that respect the fill target.
+ * Returns the root of the new tree.
+ */
+node *bulk_load_finish(bulk_loader *loader)
+{
+  int fanout = loader->node_keys + 1;
+  int num_parents, first, count, p, j;
+  node *parent, *child, *root = NULL;
+
+  while (loader->num_nodes > 1)
+  {
+    num_parents = (loader->num_nodes + fanout - 1) / fanout;
+    first = 0;
+    for (p = 0; p < num_parents; p++)
+    {
+      count = loader->num_nodes / num_parents +
+              (p < loader->num_nodes % num_parents ? 1 : 0);
+      parent = make_node(loader->order);
+      for (j = 0; j < count; j++)
+      {
+        child = loader->nodes[first + j];
+        child->parent = parent;
+        parent->pointers[j] = child;
+        if (j > 0)
+          parent->keys[j - 1] = loader->min_keys[first + j];
+      }
+      parent->num_keys = count - 1;
+
+      /* The parents are written over the level
+       * below, which is safe because parent p
+       * never starts before child p.
+       */
+      loader->min_keys[p] = loader->min_keys[first];
+      loader->nodes[p] = parent;
+      first += count;
+    }
+    loader->num_nodes = num_parents;
+  }
+
+  if (loader->num_nodes == 1)
+    root = loader->nodes[0];
+
+  free(loader->nodes);
+  free(loader->min_keys);
+  loader->nodes = NULL;
+  loader->min_keys = NULL;
+  loader->num_nodes = 0;
+  loader->capacity = 0;
+  return root;
+}
+
+/* Builds a tree from arrays of keys in strictly
+ * ascending order and their records, without
+ * any splits or searches.
+ */
+node *bulk_load(int keys[], record records[], int num_keys, int order,
+                int fill_percent)
+{
+  bulk_loader loader;
+  int i;
+
+  bulk_load_start(&loader, order, fill_percent);
+  for (i = 0; i < num_keys; i++)
+    bulk_load_add(&loader, keys[i], records[i].page, records[i].offset);
+  return bulk_load_finish(&loader);
+}
+
+/* Insertion of a key expected to be greater than
+ * every key in the tree, such as the next value
+ * of an auto increment.
+ * The key is appended to the rightmost leaf,
+ * remembered by the caller in *last_leaf, with
+ * no search from the root.  If the hint is
+ * missing or no longer the rightmost leaf, it is
+ * found by following the last pointers, and if
+ * the key is not the greatest, it falls back to
+ * insert().  *last_leaf is kept up to date.
+ */
+node *insert_sequential(node *root, int order, node **last_leaf,
+                        int key, int page, int offset)
+{
+  record new_record;
+  node *leaf = *last_leaf;
+
+  if (leaf == NULL || !on_right_spine(leaf))
+    leaf = rightmost_leaf(root);
+
+  if (leaf == NULL || key <= leaf->keys[leaf->num_keys - 1])
+  {
+    root = insert(root, order, key, page, offset);
+    *last_leaf = rightmost_leaf(root);
+    return root;
+  }
+
+  new_record.page = page;
+  new_record.offset = offset;
+
+  if (leaf->num_keys < leaf->order - 1)
+  {
+    leaf->keys[leaf->num_keys] = key;
+    leaf->records[leaf->num_keys] = new_record;
+    leaf->num_keys++;
+    mark_dirty(leaf);
+    *last_leaf = leaf;
+    return root;
+  }
+
+  root = insert_into_leaf_after_splitting(root, leaf, key, &new_record);
+  *last_leaf = rightmost_leaf(root);
+  return root;
+}
+
+// BATCH INSERTION
+
+/* Stable merge sort of a batch by key, so that
+ * among repeated keys the last one given wins.
+ */
+static void sort_entries(entry entries[], entry temp[], int n)
+{
+  int width, lo, mid, hi, i, j, k;
+  for (width = 1; width < n; width *= 2)
+  {
+    for (lo = 0; lo < n; lo += 2 * width)
+    {
+      mid = lo + width < n ? lo + width : n;
+      hi = lo + 2 * width < n ? lo + 2 * width : n;
+      for (i = lo, j = mid, k = lo; k < hi; k++)
+        temp[k] = (i < mid && (j >= hi || entries[i].key <= entries[j].key))
+                      ? entries[i++]
+                      : entries[j++];
+    }
+    memcpy(entries, temp, n * sizeof(entry));
+  }
+}
+
+/* Like find_leaf, but also returns in *upper the
+ * smallest separator key to the right of the path,
+ * which bounds the keys that belong to the leaf.
+ * *has_upper is false for the rightmost leaf.
+ */
+static node *find_leaf_bounded(node *const root, int key, int *upper,
+                               bool *has_upper)
+{
+  node *c = root;
+  int i;
+  *has_upper = false;
+  while (!c->is_leaf)
+  {
+    i = upper_bound(c->keys, c->num_keys, key);
+    if (i < c->num_keys)
+    {
+      *upper = c->keys[i];
+      *has_upper = true;
+    }
+    c = get_child(c, i);
+  }
+  return c;
+}
+
+/* Inserts a batch of keys and records.
+ * The batch is sorted (and repeated keys reduced
+ * to the last one), then merged into the tree
+ * one leaf at a time: each leaf is found once
+ * for all the keys that belong to it, and if they
+ * do not fit, the merged keys are spread over as
+ * many new leaves as needed, which are added to
+ * the parent one after the other.  Existing keys
+ * have their records updated, as in insert().
+ * The entries array is reordered.
+ * Returns the root of the tree after insertion.
+ */
+node *insert_batch(node *root, int order, entry entries[], int num_entries)
+{
+  entry *temp;
+  node *leaf, *left, *new_leaf;
+  int *merged_keys;
+  record *merged_records;
+  int i, j, n, a, b, total, num_leaves, chunk, upper;
+  bool has_upper, pack;
+
+  if (num_entries <= 0)
+    return root;
+
+  temp = malloc(num_entries * sizeof(entry));
+  if (temp == NULL)
+  {
+    perror("Temporary batch array.");
+    exit(EXIT_FAILURE);
+  }
+  sort_entries(entries, temp, num_entries);
+  free(temp);
+
+  for (i = 0, n = 0; i < num_entries; i++)
+  {
+    if (n > 0 && entries[n - 1].key == entries[i].key)
+      n--;
+    entries[n++] = entries[i];
+  }
+  num_entries = n;
+
+  if (root == NULL)
+  {
+    root = start_new_tree(order, entries[0].key, &entries[0].value);
+    entries++;
+    num_entries--;
+  }
+  order = root->order;
+
+  merged_keys = malloc((order - 1 + num_entries) * sizeof(int));
+  merged_records = malloc((order - 1 + num_entries) * sizeof(record));
+  if (merged_keys == NULL || merged_records == NULL)
+  {
+    perror("Temporary batch merge arrays.");
+    exit(EXIT_FAILURE);
+  }
+
+  i = 0;
+  while (i < num_entries)
+  {
+    leaf = find_leaf_bounded(root, entries[i].key, &upper, &has_upper);
+
+    /* The keys of the batch that belong to this leaf.
+     */
+    for (j = i; j < num_entries && (!has_upper || entries[j].key < upper); j++)
+      ;
+
+    /* Merge them with the keys already in the leaf.
+     */
+    total = 0;
+    for (a = 0, b = i; a < leaf->num_keys || b < j;)
+    {
+      if (b == j || (a < leaf->num_keys && leaf->keys[a] < entries[b].key))
+      {
+        merged_keys[total] = leaf->keys[a];
+        merged_records[total++] = leaf->records[a++];
+      }
+      else
+      {
+        if (a < leaf->num_keys && leaf->keys[a] == entries[b].key)
+          a++;
+        merged_keys[total] = entries[b].key;
+        merged_records[total++] = entries[b++].value;
+      }
+    }
+
+    /* Spread them over the leaf and, if needed,
+     * new leaves to its right: evenly, or packed
+     * full at the right edge of the tree.
+     */
+    num_leaves = (total + order - 2) / (order - 1);
+    pack = !has_upper;
+    left = NULL;
+    for (a = 0, b = 0; b < num_leaves; b++)
+    {
+      if (pack)
+        chunk = total - a < order - 1 ? total - a : order - 1;
+      else
+        chunk = (total - a) / (num_leaves - b);
+
+      if (b == 0)
+      {
+        new_leaf = leaf;
+        mark_dirty(leaf);
+      }
+      else
+      {
+        new_leaf = make_leaf(order);
+        new_leaf->owner = leaf->owner;
+      }
+      memcpy(new_leaf->keys, merged_keys + a, chunk * sizeof(int));
+      memcpy(new_leaf->records, merged_records + a, chunk * sizeof(record));
+      new_leaf->num_keys = chunk;
+      a += chunk;
+
+      if (b > 0)
+      {
+        new_leaf->parent = left->parent;
+        root = insert_into_parent(root, left, new_leaf->keys[0], new_leaf);
+      }
+      left = new_leaf;
+    }
+
+    i = j;
+  }
+
+  free(merged_keys);
+  free(merged_records);
+  return root;
+}
+
 void destroy_tree_nodes(node *root)
 {
   int i;
-  if (root->is_leaf)
-    for (i = 0; i < root->num_keys; i++)
-      free(root->pointers[i]);
-  else
+  if (!root->is_leaf)
     for (i = 0; i < root->num_keys + 1; i++)
-      destroy_tree_nodes(root->pointers[i]);
-  free(root->pointers);
-  free(root->keys);
+      if (!UNLOADED(root->pointers[i]))
+        destroy_tree_nodes(root->pointers[i]);
   free(root);
+  live_nodes--;
 }
 
 node *destroy_tree(node *root)
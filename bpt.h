@@ -62,15 +62,21 @@
 #endif
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 
+// Nodes are allocated in multiples of a cache line.
+#define CACHE_LINE 64
+
 // Default order is 4.
 #define DEFAULT_ORDER 4
 
 // Minimum order is necessarily 3.  We set the maximum
 // order arbitrarily.  You may change the maximum order.
+// Orders in the hundreds pay off with the vectorized
+// in-node search.
 #define MIN_ORDER 3
-#define MAX_ORDER 20
+#define MAX_ORDER 1024
 
 // Constant for optional command-line input with "i" command.
 #define BUFFER_SIZE 256
@@ -93,19 +99,29 @@ typedef struct record
   int offset;
 } record;
 
+/* Type representing a key together with
+ * its record, as passed in batches.
+ */
+typedef struct entry
+{
+  int key;
+  record value;
+} entry;
+
 /* Type representing a node in the B+ tree.
  * This type is general enough to serve for both
  * the leaf and the internal node.
  * The heart of the node is the array
  * of keys and the array of corresponding
- * pointers.  The relation between keys
- * and pointers differs between leaves and
- * internal nodes.  In a leaf, the index
+ * records or pointers.  Both live in the same
+ * allocation as the node: the keys start right
+ * after the header, which fills one cache line,
+ * and are followed by the area holding either
+ * the records of a leaf or the pointers of an
+ * internal node.  In a leaf, the index
  * of each key equals the index of its corresponding
- * pointer, with a maximum of order - 1 key-pointer
- * pairs.  The last pointer points to the
- * leaf to the right (or NULL in the case
- * of the rightmost leaf).
+ * record, stored inline, with a maximum of
+ * order - 1 key-record pairs.
  * In an internal node, the first pointer
  * refers to lower nodes with keys less than
  * the smallest key in the keys array.  Then,
@@ -113,24 +129,84 @@ typedef struct record
  * at i + 1 points to the subtree with keys
  * greater than or equal to the key in this
  * node at index i.
+ * The order field determines the maximum and
+ * minimum number of entries (keys and pointers)
+ * in the node.  Every node has at most order - 1
+ * keys and at least (roughly speaking) half that
+ * number.  All the nodes of a tree share the
+ * order it was created with.
  * The num_keys field is used to keep
  * track of the number of valid keys.
  * In an internal node, the number of valid
  * pointers is always num_keys + 1.
- * In a leaf, the number of valid pointers
- * to data is always num_keys.  The
- * last leaf pointer points to the next leaf.
+ * In a leaf, the number of valid records
+ * is always num_keys.
+ * The disk_page field holds the page of the
+ * index file where the node is stored (0 while
+ * the node has never been written), and nodes
+ * changed since their last write are marked
+ * dirty and chained through next_dirty.
+ * A child that is not in memory is kept in the
+ * pointers of its parent as the page where it is
+ * stored, tagged by the lowest bit (see UNLOADED),
+ * and is read through load_node when the child
+ * is first visited.  The owner field is left to
+ * the caller (the index a node belongs to, for
+ * load_node); nodes split from another node or
+ * read as its children inherit it.
  */
 typedef struct node
 {
-  void **pointers;
-  int *keys;
-  struct node *parent;
-  bool is_leaf;
   int num_keys;
+  bool is_leaf;
+  bool dirty;
+  int disk_page;
+  int order;
+  struct node *parent;
+  struct node **pointers;
+  record *records;
+  void *owner;
   struct node *next; // Used for queue.
+  struct node *next_dirty;
+  int keys[];
 } node;
 
+/* A child that is not in memory, in the pointers
+ * of an internal node.  Nodes are aligned to a
+ * cache line, so a pointer to a node never has
+ * its lowest bit set.
+ */
+#define UNLOADED(pointer) (((uintptr_t)(pointer) & 1) != 0)
+#define UNLOADED_PAGE(pointer) ((int)((uintptr_t)(pointer) >> 1))
+#define UNLOADED_CHILD(page) ((node *)(((uintptr_t)(page) << 1) | 1))
+
+// GLOBALS.
+
+extern node *dirty_nodes;
+extern long live_nodes;
+extern node *(*load_node)(node *parent, int page);
+
+/* State of a bottom-up bulk load.
+ * Keys arrive in strictly ascending order and
+ * are packed into leaves up to leaf_keys keys
+ * each; the leaves (and later each internal
+ * level) are kept in the nodes array together
+ * with the smallest key under each of them,
+ * which becomes the separator key in the
+ * level above.
+ */
+typedef struct bulk_loader
+{
+  node **nodes;
+  int *min_keys;
+  int num_nodes;
+  int capacity;
+  int order;
+  int leaf_keys;
+  int node_keys;
+  int last_key;
+} bulk_loader;
+
 // FUNCTION PROTOTYPES.
 
 // Output and utility.
@@ -138,14 +214,22 @@ typedef struct node
 int find_range(node *const root, int key_start, int key_end, bool verbose,
                int returned_keys[], void *returned_pointers[]);
 node *find_leaf(node *const root, int key, bool verbose);
+node *rightmost_leaf(node *const root);
 record *find(node *root, int key, bool verbose, node **leaf_out);
+void find_many(node *const root, const int keys[], int num_keys,
+               record *out[]);
+node *get_child(node *n, int i);
+void unload_child(node *n, int i);
 int cut(int length);
+void mark_dirty(node *n);
+void clean_dirty_nodes(void);
 
 // Insertion.
 
-record *make_record(int page, int offset);
-node *make_node(void);
-node *make_leaf(void);
+size_t node_size(int order);
+int order_for_node_size(size_t size);
+node *make_node(int order);
+node *make_leaf(int order);
 int get_left_index(node *parent, node *left);
 node *insert_into_leaf(node *leaf, int key, record *pointer);
 node *insert_into_leaf_after_splitting(node *root, node *leaf, int key,
@@ -157,8 +241,19 @@ node *insert_into_node_after_splitting(node *root, node *parent,
                                        int key, node *right);
 node *insert_into_parent(node *root, node *left, int key, node *right);
 node *insert_into_new_root(node *left, int key, node *right);
-node *start_new_tree(int key, record *pointer);
-node *insert(node *root, int key, int page, int offset);
+node *start_new_tree(int order, int key, record *pointer);
+node *insert(node *root, int order, int key, int page, int offset);
+node *insert_sequential(node *root, int order, node **last_leaf,
+                        int key, int page, int offset);
+node *insert_batch(node *root, int order, entry entries[], int num_entries);
+
+// Bulk loading.
+
+void bulk_load_start(bulk_loader *loader, int order, int fill_percent);
+bool bulk_load_add(bulk_loader *loader, int key, int page, int offset);
+node *bulk_load_finish(bulk_loader *loader);
+node *bulk_load(int keys[], record records[], int num_keys, int order,
+                int fill_percent);
 
 
 node *destroy_tree(node *root);
\ No newline at end of file
@@ -0,0 +1,379 @@
+/*
+ *  bpt_test.c
+ *
+ *  Randomized differential check of the B+ tree: trees built with
+ *  insert_batch, insert_sequential and bulk_load, and trees whose
+ *  nodes are unloaded and read back through load_node, must hold the
+ *  same keys and records as a tree built one key at a time with
+ *  insert(), for every order from MIN_ORDER to MAX_TEST_ORDER.
+ *  The structure of each tree is checked as well.
+ *
+ *  Run by test.sh.  Prints each failure and exits with 1 if any.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bpt.h"
+
+#define MAX_TEST_ORDER 39
+
+// Keys are drawn from [1, KEY_RANGE], so that some repeat.
+#define KEY_RANGE 6000
+#define NUM_KEYS 4000
+
+// Largest batch given to insert_batch.
+#define MAX_BATCH 300
+
+/* Expected record of each key (page 0 when
+ * the key is not in the tree).
+ */
+static record expected[KEY_RANGE + 2];
+
+static int failures = 0;
+
+/* A node as written to the simulated index
+ * file, with the pages of its children.
+ */
+typedef struct stored_node
+{
+  bool is_leaf;
+  int num_keys;
+  int keys[MAX_TEST_ORDER];
+  record records[MAX_TEST_ORDER];
+  int children[MAX_TEST_ORDER + 1];
+} stored_node;
+
+/* Nodes written to the simulated index file,
+ * by page, read back by load_test_node.
+ */
+static stored_node *disk = NULL;
+static int num_pages = 0;
+
+static void fail(const char *path, int order, const char *what, int key)
+{
+  if (failures < 20)
+    printf("%s, order %d: %s (key %d)\n", path, order, what, key);
+  failures++;
+}
+
+static int random_key(void)
+{
+  return rand() % KEY_RANGE + 1;
+}
+
+/* Checks the structure of the subtree under n:
+ * sorted keys within the bounds given by the
+ * parent, key counts within the order, parent
+ * pointers and leaves at the same depth.
+ * Returns the number of keys in the leaves.
+ */
+static long check_node(const char *path, node *n, node *parent, int order,
+                       long low, long high, int depth, int *leaf_depth)
+{
+  long count = 0;
+  int i;
+
+  if (n->parent != parent)
+    fail(path, order, "wrong parent pointer", n->keys[0]);
+  if (n->order != order)
+    fail(path, order, "wrong node order", n->keys[0]);
+  if (n->num_keys > order - 1 || n->num_keys < 1)
+    fail(path, order, "key count out of bounds", n->num_keys);
+  for (i = 0; i < n->num_keys; i++)
+  {
+    if (n->keys[i] < low || n->keys[i] >= high ||
+        (i > 0 && n->keys[i] <= n->keys[i - 1]))
+      fail(path, order, "key out of order", n->keys[i]);
+  }
+
+  if (n->is_leaf)
+  {
+    if (*leaf_depth < 0)
+      *leaf_depth = depth;
+    else if (*leaf_depth != depth)
+      fail(path, order, "leaves at different depths", n->keys[0]);
+    return n->num_keys;
+  }
+
+  for (i = 0; i <= n->num_keys; i++)
+  {
+    if (UNLOADED(n->pointers[i]))
+      continue;
+    count += check_node(path, n->pointers[i], n, order,
+                        i == 0 ? low : n->keys[i - 1],
+                        i == n->num_keys ? high : n->keys[i],
+                        depth + 1, leaf_depth);
+  }
+  return count;
+}
+
+/* Checks the tree against the expected records,
+ * with find for every key in the range and
+ * find_many for all of them at once.
+ */
+static void check_tree(const char *path, node *root, int order)
+{
+  static int keys[KEY_RANGE + 2];
+  static record *found[KEY_RANGE + 2];
+  record *r;
+  long in_tree = 0, in_leaves;
+  int leaf_depth = -1, key;
+
+  for (key = 0; key <= KEY_RANGE + 1; key++)
+  {
+    keys[key] = key;
+    if (expected[key].page != 0)
+      in_tree++;
+  }
+
+  /* Lookups first: they read every leaf that is
+   * not in memory, so that the structure check
+   * covers the whole tree.
+   */
+  find_many(root, keys, KEY_RANGE + 2, found);
+  for (key = 0; key <= KEY_RANGE + 1; key++)
+  {
+    r = find(root, key, false, NULL);
+    if (expected[key].page == 0)
+    {
+      if (r != NULL || found[key] != NULL)
+        fail(path, order, "key found but never inserted", key);
+      continue;
+    }
+    if (r == NULL || found[key] == NULL)
+      fail(path, order, "key missing", key);
+    else if (r->page != expected[key].page || r->offset != expected[key].offset ||
+             found[key] != r)
+      fail(path, order, "wrong record", key);
+  }
+
+  if (root == NULL)
+  {
+    if (in_tree > 0)
+      fail(path, order, "empty tree", 0);
+    return;
+  }
+  in_leaves = check_node(path, root, NULL, order, 0, (long)KEY_RANGE + 2,
+                         0, &leaf_depth);
+  if (in_leaves != in_tree)
+    fail(path, order, "wrong number of keys in the leaves", (int)in_leaves);
+}
+
+/* Writes the subtree under n to the simulated
+ * file, children first, as the index does.
+ */
+static void write_test_nodes(node *n)
+{
+  stored_node *stored;
+  int i;
+
+  if (!n->is_leaf)
+    for (i = 0; i <= n->num_keys; i++)
+      if (!UNLOADED(n->pointers[i]))
+        write_test_nodes(n->pointers[i]);
+
+  if (n->disk_page == 0)
+  {
+    disk = realloc(disk, (num_pages + 2) * sizeof(stored_node));
+    if (disk == NULL)
+    {
+      perror("Test disk.");
+      exit(EXIT_FAILURE);
+    }
+    n->disk_page = ++num_pages;
+  }
+
+  stored = &disk[n->disk_page];
+  stored->is_leaf = n->is_leaf;
+  stored->num_keys = n->num_keys;
+  memcpy(stored->keys, n->keys, n->num_keys * sizeof(int));
+  if (n->is_leaf)
+    memcpy(stored->records, n->records, n->num_keys * sizeof(record));
+  else
+    for (i = 0; i <= n->num_keys; i++)
+      stored->children[i] = UNLOADED(n->pointers[i])
+                                ? UNLOADED_PAGE(n->pointers[i])
+                                : n->pointers[i]->disk_page;
+}
+
+static node *load_test_node(node *parent, int page)
+{
+  stored_node *stored = &disk[page];
+  node *n = make_node(parent->order);
+  int i;
+
+  n->is_leaf = stored->is_leaf;
+  n->num_keys = stored->num_keys;
+  n->disk_page = page;
+  memcpy(n->keys, stored->keys, stored->num_keys * sizeof(int));
+  if (n->is_leaf)
+    memcpy(n->records, stored->records, stored->num_keys * sizeof(record));
+  else
+    for (i = 0; i <= n->num_keys; i++)
+      n->pointers[i] = UNLOADED_CHILD(stored->children[i]);
+  return n;
+}
+
+/* Writes the tree and frees every node below the
+ * root, so that the next operations read them
+ * back through load_node.
+ */
+static void unload_tree(node *root)
+{
+  int i;
+
+  if (root == NULL)
+    return;
+  write_test_nodes(root);
+  clean_dirty_nodes();
+  for (i = 0; !root->is_leaf && i <= root->num_keys; i++)
+    unload_child(root, i);
+}
+
+static void free_disk(void)
+{
+  free(disk);
+  disk = NULL;
+  num_pages = 0;
+}
+
+static void set_expected(int key, int page, int offset)
+{
+  expected[key].page = page;
+  expected[key].offset = offset;
+}
+
+static node *free_tree(node *root)
+{
+  clean_dirty_nodes();
+  if (root != NULL)
+    destroy_tree(root);
+  free_disk();
+  return NULL;
+}
+
+int main(void)
+{
+  static entry batch[MAX_BATCH];
+  static int sorted_keys[NUM_KEYS];
+  static record sorted_records[NUM_KEYS];
+  node *root, *last_leaf;
+  int order, i, n, key, size, num_sorted;
+
+  srand(2018);
+  load_node = load_test_node;
+
+  for (order = MIN_ORDER; order <= MAX_TEST_ORDER; order++)
+  {
+    // insert(), in random order, with repeated keys.
+    memset(expected, 0, sizeof(expected));
+    root = NULL;
+    for (i = 0; i < NUM_KEYS; i++)
+    {
+      key = random_key();
+      root = insert(root, order, key, i + 1, key);
+      set_expected(key, i + 1, key);
+    }
+    check_tree("insert", root, order);
+    unload_tree(root);
+    check_tree("insert, unloaded", root, order);
+    for (i = 0; i < NUM_KEYS / 4; i++)
+    {
+      key = random_key();
+      root = insert(root, order, key, i + 1, -key);
+      set_expected(key, i + 1, -key);
+    }
+    check_tree("insert after unloading", root, order);
+    root = free_tree(root);
+
+    // insert_batch, with batches of random sizes.
+    memset(expected, 0, sizeof(expected));
+    for (n = 0; n < NUM_KEYS; n += size)
+    {
+      size = rand() % MAX_BATCH + 1;
+      if (size > NUM_KEYS - n)
+        size = NUM_KEYS - n;
+      for (i = 0; i < size; i++)
+      {
+        batch[i].key = random_key();
+        batch[i].value.page = n + i + 1;
+        batch[i].value.offset = batch[i].key;
+        set_expected(batch[i].key, n + i + 1, batch[i].key);
+      }
+      root = insert_batch(root, order, batch, size);
+      if (n == NUM_KEYS / 2)
+        unload_tree(root);
+    }
+    check_tree("insert_batch", root, order);
+    unload_tree(root);
+    for (i = 0; i < MAX_BATCH; i++)
+    {
+      batch[i].key = random_key();
+      batch[i].value.page = i + 1;
+      batch[i].value.offset = 0;
+      set_expected(batch[i].key, i + 1, 0);
+    }
+    root = insert_batch(root, order, batch, MAX_BATCH);
+    check_tree("insert_batch after unloading", root, order);
+    root = free_tree(root);
+
+    // insert_sequential, with some keys out of order.
+    memset(expected, 0, sizeof(expected));
+    last_leaf = NULL;
+    for (i = 0, key = 0; i < NUM_KEYS; i++)
+    {
+      key = rand() % 8 == 0 ? random_key() : key + 1;
+      if (key > KEY_RANGE)
+        key = random_key();
+      root = insert_sequential(root, order, &last_leaf, key, i + 1, key);
+      set_expected(key, i + 1, key);
+      if (i == NUM_KEYS / 2)
+      {
+        unload_tree(root);
+        last_leaf = NULL;
+      }
+    }
+    check_tree("insert_sequential", root, order);
+    root = free_tree(root);
+
+    // bulk_load, then insert() and insert_batch on top.
+    memset(expected, 0, sizeof(expected));
+    for (key = 1, num_sorted = 0; key <= KEY_RANGE && num_sorted < NUM_KEYS; key++)
+    {
+      if (rand() % 3 == 0)
+        continue;
+      sorted_keys[num_sorted] = key;
+      sorted_records[num_sorted].page = key;
+      sorted_records[num_sorted].offset = num_sorted;
+      set_expected(key, key, num_sorted);
+      num_sorted++;
+    }
+    root = bulk_load(sorted_keys, sorted_records, num_sorted, order,
+                     rand() % 100 + 1);
+    check_tree("bulk_load", root, order);
+    unload_tree(root);
+    for (i = 0; i < NUM_KEYS / 4; i++)
+    {
+      key = random_key();
+      root = insert(root, order, key, i + 1, key);
+      set_expected(key, i + 1, key);
+    }
+    for (i = 0; i < MAX_BATCH; i++)
+    {
+      batch[i].key = random_key();
+      batch[i].value.page = i + 1;
+      batch[i].value.offset = 1;
+      set_expected(batch[i].key, i + 1, 1);
+    }
+    root = insert_batch(root, order, batch, MAX_BATCH);
+    check_tree("bulk_load, then inserts", root, order);
+    root = free_tree(root);
+  }
+
+  if (failures > 0)
+    printf("%d failures\n", failures);
+  return failures > 0 ? 1 : 0;
+}
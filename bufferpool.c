@@ -0,0 +1,439 @@
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bufferpool.h"
+
+// GLOBALS.
+
+static frame *frames = NULL;
+static int num_frames = 0;
+
+/* Hash table from (table, page) to frame,
+ * chained through next_in_bucket.  -1 ends
+ * a chain.
+ */
+static int *buckets = NULL;
+static int num_buckets = 0;
+
+static int clock_hand = 0;
+
+static buffer_stats stats;
+
+/* Open storage of the tables already used.
+ */
+static table_file *table_files = NULL;
+
+/* Called before a dirty page is written, so
+ * that the log of its changes is durable first.
+ */
+static void (*before_write)(void) = NULL;
+
+// FUNCTION DEFINITIONS.
+
+static unsigned hash_page(const char *table, int page_no)
+{
+  unsigned h = 5381;
+  while (*table)
+    h = h * 33 + (unsigned char)*table++;
+  return (h ^ (unsigned)page_no * 2654435761u) % (unsigned)num_buckets;
+}
+
+/* Opens the storage of a table, once.  A table
+ * with page1.dat keeps the old layout of one
+ * file per page; any other table keeps all its
+ * pages in data.dat, created here with page 0
+ * holding its magic number.
+ */
+static table_file *open_table_file(const char *table)
+{
+  char path[600];
+  table_file *t;
+  struct stat st;
+  int magic = DATA_MAGIC;
+
+  for (t = table_files; t != NULL; t = t->next)
+    if (strcmp(t->table, table) == 0)
+      return t;
+
+  t = malloc(sizeof(table_file));
+  if (t == NULL)
+  {
+    perror("Table file creation.");
+    exit(EXIT_FAILURE);
+  }
+  strncpy(t->table, table, sizeof(t->table) - 1);
+  t->table[sizeof(t->table) - 1] = '\0';
+  t->fd = -1;
+  t->allocated = 0;
+
+  snprintf(path, sizeof(path), "%s/page1.dat", table);
+  t->single_file = stat(path, &st) != 0;
+  if (t->single_file)
+  {
+    snprintf(path, sizeof(path), "%s/data.dat", table);
+    t->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (t->fd < 0)
+    {
+      free(t);
+      return NULL;
+    }
+    fstat(t->fd, &st);
+    t->allocated = st.st_size;
+    if (st.st_size == 0 && pwrite(t->fd, &magic, sizeof(int), 0) != sizeof(int))
+      perror("Data file header write.");
+  }
+
+  t->next = table_files;
+  table_files = t;
+  return t;
+}
+
+/* Makes room in data.dat for a page, growing
+ * the file a whole extent at a time so that it
+ * stays contiguous on disk.
+ */
+static void reserve_page(table_file *t, int page_no)
+{
+  off_t end = (off_t)(page_no + 1) * PAGE_BYTES;
+  off_t grow;
+
+  if (end <= t->allocated)
+    return;
+  grow = (off_t)DATA_EXTENT_PAGES * PAGE_BYTES;
+  while (t->allocated + grow < end)
+    grow += (off_t)DATA_EXTENT_PAGES * PAGE_BYTES;
+  if (posix_fallocate(t->fd, t->allocated, grow) == 0)
+    t->allocated += grow;
+  else
+    t->allocated = end;
+  stats.extents++;
+}
+
+/* Reads a page from its file.  A page past the
+ * end of the file, or a page file shorter than
+ * a page (as written by createPage), reads as
+ * zeros past its end.
+ */
+static void read_page(frame *f)
+{
+  char path[600];
+  table_file *t = open_table_file(f->table);
+  ssize_t got = 0;
+  int fd;
+
+  if (t != NULL && t->single_file)
+    got = pread(t->fd, f->data, PAGE_BYTES, (off_t)f->page_no * PAGE_BYTES);
+  else
+  {
+    snprintf(path, sizeof(path), "%s/page%d.dat", f->table, f->page_no);
+    fd = open(path, O_RDONLY);
+    if (fd >= 0)
+    {
+      got = pread(fd, f->data, PAGE_BYTES, 0);
+      close(fd);
+    }
+  }
+  if (got < 0)
+    got = 0;
+  memset(f->data + got, 0, PAGE_BYTES - got);
+  stats.reads++;
+}
+
+static void write_page(frame *f)
+{
+  char path[600];
+  table_file *t = open_table_file(f->table);
+  ssize_t put = -1;
+  int fd;
+
+  if (before_write != NULL)
+    before_write();
+
+  if (t != NULL && t->single_file)
+  {
+    reserve_page(t, f->page_no);
+    put = pwrite(t->fd, f->data, PAGE_BYTES, (off_t)f->page_no * PAGE_BYTES);
+  }
+  else
+  {
+    snprintf(path, sizeof(path), "%s/page%d.dat", f->table, f->page_no);
+    fd = open(path, O_WRONLY | O_CREAT, 0644);
+    if (fd >= 0)
+    {
+      // synced now, the file is not kept open for sync_pages
+      put = pwrite(fd, f->data, PAGE_BYTES, 0);
+      fdatasync(fd);
+      close(fd);
+    }
+  }
+  if (put != PAGE_BYTES)
+    perror("Buffer pool page write.");
+  f->dirty = false;
+  stats.writes++;
+}
+
+void buffer_pool_init(size_t budget_bytes)
+{
+  int i;
+
+  num_frames = (int)(budget_bytes / PAGE_BYTES);
+  if (num_frames < 2)
+    num_frames = 2;
+  num_buckets = num_frames * 2;
+  frames = calloc(num_frames, sizeof(frame));
+  buckets = malloc(num_buckets * sizeof(int));
+  if (frames == NULL || buckets == NULL)
+  {
+    perror("Buffer pool creation.");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < num_frames; i++)
+  {
+    if (posix_memalign((void **)&frames[i].data, PAGE_BYTES, PAGE_BYTES) != 0)
+    {
+      perror("Buffer pool frame.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (i = 0; i < num_buckets; i++)
+    buckets[i] = -1;
+}
+
+static int lookup(const char *table, int page_no)
+{
+  int i;
+  for (i = buckets[hash_page(table, page_no)]; i != -1; i = frames[i].next_in_bucket)
+    if (frames[i].page_no == page_no && strcmp(frames[i].table, table) == 0)
+      return i;
+  return -1;
+}
+
+static void unlink_frame(int victim)
+{
+  int *link = &buckets[hash_page(frames[victim].table, frames[victim].page_no)];
+  while (*link != victim)
+    link = &frames[*link].next_in_bucket;
+  *link = frames[victim].next_in_bucket;
+  frames[victim].valid = false;
+}
+
+/* Picks a frame for a new page with CLOCK:
+ * the hand skips pinned frames and clears the
+ * referenced bit of the others, stopping at
+ * the first one already clear.
+ */
+static int evict(void)
+{
+  int scanned;
+  frame *f;
+
+  for (scanned = 0; scanned < 2 * num_frames; scanned++)
+  {
+    f = &frames[clock_hand];
+    clock_hand = (clock_hand + 1) % num_frames;
+    if (!f->valid)
+      return (int)(f - frames);
+    if (f->pin_count > 0)
+      continue;
+    if (f->referenced)
+    {
+      f->referenced = false;
+      continue;
+    }
+    if (f->dirty)
+      write_page(f);
+    unlink_frame((int)(f - frames));
+    stats.evictions++;
+    return (int)(f - frames);
+  }
+  fprintf(stderr, "Buffer pool: every frame is pinned\n");
+  exit(EXIT_FAILURE);
+}
+
+static frame *pin(const char *table, int page_no, bool read)
+{
+  unsigned bucket;
+  frame *f;
+  int i;
+
+  if (frames == NULL)
+    buffer_pool_init(BUFFER_POOL_DEFAULT_BYTES);
+
+  i = lookup(table, page_no);
+  if (i != -1)
+  {
+    stats.hits++;
+    f = &frames[i];
+  }
+  else
+  {
+    stats.misses++;
+    i = evict();
+    f = &frames[i];
+    strncpy(f->table, table, sizeof(f->table) - 1);
+    f->table[sizeof(f->table) - 1] = '\0';
+    f->page_no = page_no;
+    f->valid = true;
+    f->dirty = false;
+    f->pin_count = 0;
+    bucket = hash_page(table, page_no);
+    f->next_in_bucket = buckets[bucket];
+    buckets[bucket] = i;
+    if (read)
+      read_page(f);
+  }
+  f->pin_count++;
+  f->referenced = true;
+  return f;
+}
+
+/* Returns the page pinned, reading it from
+ * disk if it is not in the pool.
+ */
+char *pin_page(const char *table, int page_no)
+{
+  return pin(table, page_no, true)->data;
+}
+
+/* Returns a page being created pinned, zeroed
+ * and dirty, without reading its file.
+ */
+char *pin_new_page(const char *table, int page_no)
+{
+  frame *f = pin(table, page_no, false);
+  memset(f->data, 0, PAGE_BYTES);
+  f->dirty = true;
+  return f->data;
+}
+
+void unpin_page(const char *table, int page_no, bool dirty)
+{
+  int i = lookup(table, page_no);
+  if (i == -1 || frames[i].pin_count == 0)
+  {
+    fprintf(stderr, "Buffer pool: page %d of %s is not pinned\n", page_no, table);
+    return;
+  }
+  frames[i].pin_count--;
+  frames[i].dirty |= dirty;
+}
+
+/* Writes every dirty page back to its file.
+ */
+void flush_pages(void)
+{
+  int i;
+  for (i = 0; i < num_frames; i++)
+    if (frames[i].valid && frames[i].dirty)
+      write_page(&frames[i]);
+}
+
+/* Writes the dirty pages of one table back to
+ * its file, leaving those of the other tables
+ * in the pool.
+ */
+static void flush_table_pages(const char *table)
+{
+  int i;
+  for (i = 0; i < num_frames; i++)
+    if (frames[i].valid && frames[i].dirty &&
+        strcmp(frames[i].table, table) == 0)
+      write_page(&frames[i]);
+}
+
+/* Writes every dirty page back and syncs the
+ * files of the tables, for a checkpoint.
+ */
+void sync_pages(void)
+{
+  table_file *t;
+
+  flush_pages();
+  for (t = table_files; t != NULL; t = t->next)
+    if (t->fd >= 0 && fdatasync(t->fd) != 0)
+      perror("Buffer pool sync.");
+}
+
+void buffer_pool_before_write(void (*hook)(void))
+{
+  before_write = hook;
+}
+
+/* Drops the pages of a table without writing
+ * them and closes its storage, for a table
+ * whose files are removed.
+ */
+void discard_pages(const char *table)
+{
+  table_file **link = &table_files, *t;
+  int i;
+
+  for (i = 0; i < num_frames; i++)
+    if (frames[i].valid && strcmp(frames[i].table, table) == 0)
+      unlink_frame(i);
+
+  while (*link != NULL)
+  {
+    t = *link;
+    if (strcmp(t->table, table) == 0)
+    {
+      *link = t->next;
+      if (t->fd >= 0)
+        close(t->fd);
+      free(t);
+    }
+    else
+      link = &t->next;
+  }
+}
+
+/* Maps the data.dat of a table read-only for a
+ * scan, after writing back the dirty pages of
+ * that table only, and
+ * tells the kernel it is read in order so it
+ * reads ahead.  Returns NULL for a table with
+ * one file per page or without any page yet.
+ */
+char *map_table_file(const char *table, size_t *size)
+{
+  table_file *t = open_table_file(table);
+  struct stat st;
+  char *base;
+
+  if (t == NULL || !t->single_file)
+    return NULL;
+  // the size is taken after the flush, which can grow the file
+  flush_table_pages(table);
+  if (fstat(t->fd, &st) != 0 || st.st_size < 2 * PAGE_BYTES)
+    return NULL;
+  base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, t->fd, 0);
+  if (base == MAP_FAILED)
+    return NULL;
+  posix_madvise(base, st.st_size, POSIX_MADV_SEQUENTIAL);
+  posix_madvise(base, st.st_size, POSIX_MADV_WILLNEED);
+  *size = st.st_size;
+  return base;
+}
+
+void unmap_table_file(char *base, size_t size)
+{
+  munmap(base, size);
+}
+
+buffer_stats buffer_pool_stats(void)
+{
+  return stats;
+}
+
+int buffer_pool_frames(void)
+{
+  return num_frames;
+}
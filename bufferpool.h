@@ -0,0 +1,99 @@
+/*
+ *  bufferpool.h
+ *
+ *  Buffer pool for table pages.
+ *
+ *  A table keeps page N at N * PAGE_BYTES of a
+ *  single data.dat, read and written with
+ *  pread/pwrite on one descriptor kept open and
+ *  grown by preallocated extents.  Tables made
+ *  before it keep one pageN.dat per page, still
+ *  read and written in place.
+ *
+ *  Pages of PAGE_BYTES are kept in a fixed number
+ *  of frames, found by (table, page number)
+ *  through a hash table.  A page is pinned while
+ *  it is used and unpinned afterwards, saying
+ *  whether it was changed.  When a page is
+ *  needed and every frame is taken, the CLOCK
+ *  policy picks an unpinned frame not referenced
+ *  since the hand last passed it, writing it back
+ *  first if it is dirty.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Size of a table page (and of a frame).
+#define PAGE_BYTES 8192
+
+// Identifies data.dat, in the first bytes of
+// its page 0 (table pages start at 1).
+#define DATA_MAGIC 0x54414450 // "PDAT"
+
+// Pages data.dat grows by at a time.
+#define DATA_EXTENT_PAGES 64
+
+// Memory of the pool when no budget is given.
+#define BUFFER_POOL_DEFAULT_BYTES (1024 * 1024)
+
+// TYPES.
+
+/* A frame holds one page.  pin_count is the
+ * number of users of the page; a pinned frame
+ * is never evicted.  referenced is the CLOCK
+ * bit, set on every pin.
+ */
+typedef struct frame
+{
+  char table[500];
+  int page_no;
+  int pin_count;
+  bool valid;
+  bool dirty;
+  bool referenced;
+  int next_in_bucket;
+  char *data;
+} frame;
+
+/* Storage of a table: single_file says whether
+ * its pages are in data.dat (fd) or in one
+ * file each.  allocated is the size data.dat
+ * was preallocated to.
+ */
+typedef struct table_file
+{
+  char table[500];
+  bool single_file;
+  int fd;
+  long allocated;
+  struct table_file *next;
+} table_file;
+
+/* Counters of the pool, for sizing it.
+ */
+typedef struct buffer_stats
+{
+  long hits;
+  long misses;
+  long evictions;
+  long reads;
+  long writes;
+  long extents;
+} buffer_stats;
+
+// FUNCTION PROTOTYPES.
+
+void buffer_pool_init(size_t budget_bytes);
+char *pin_page(const char *table, int page_no);
+char *pin_new_page(const char *table, int page_no);
+void unpin_page(const char *table, int page_no, bool dirty);
+void flush_pages(void);
+void sync_pages(void);
+void buffer_pool_before_write(void (*hook)(void));
+void discard_pages(const char *table);
+char *map_table_file(const char *table, size_t *size);
+void unmap_table_file(char *base, size_t size);
+buffer_stats buffer_pool_stats(void);
+int buffer_pool_frames(void);
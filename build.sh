@@ -6,6 +6,6 @@ clear
 #     rm -r "$DIRECTORY"
 # fi
 
-gcc -std=c99 bpt.h bpt.c primarykey.c -o out
+gcc -std=c99 -O2 bpt.h bpt.c bloom.h bloom.c bufferpool.h bufferpool.c compress.h compress.c wal.h wal.c sql.h sql.c primarykey.c -o out -lpthread
 
 ./out
\ No newline at end of file
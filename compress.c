@@ -0,0 +1,416 @@
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compress.h"
+
+// Longest run of a run length column.
+#define RUN_MAX 0xffff
+
+static const char *encoding_names[ENCODINGS] = {
+    "plain", "for", "delta", "rle", "trim", "dict"};
+
+// UTILITIES.
+
+static int int_at(const char *values, int row)
+{
+  int value;
+  memcpy(&value, values + (size_t)row * sizeof(int), sizeof(int));
+  return value;
+}
+
+/* Characters of a char value, up to its first
+ * '\0' or the width of the column.
+ */
+static int value_length(const char *value, int width)
+{
+  const char *end = memchr(value, '\0', width);
+  return end != NULL ? (int)(end - value) : width;
+}
+
+// Bytes of the length of a trimmed char value.
+static int length_bytes(int width)
+{
+  return width < 256 ? 1 : 2;
+}
+
+// Bytes needed for unsigned values up to max.
+static int bytes_for(uint32_t max)
+{
+  return max <= 0xff ? 1 : max <= 0xffff ? 2 : 4;
+}
+
+static void put_uint(char *out, uint32_t value, int bytes)
+{
+  uint8_t b = (uint8_t)value;
+  uint16_t h = (uint16_t)value;
+  if (bytes == 1)
+    memcpy(out, &b, 1);
+  else if (bytes == 2)
+    memcpy(out, &h, 2);
+  else
+    memcpy(out, &value, 4);
+}
+
+static uint32_t get_uint(const char *in, int bytes)
+{
+  uint8_t b;
+  uint16_t h;
+  uint32_t value;
+  if (bytes == 1)
+  {
+    memcpy(&b, in, 1);
+    return b;
+  }
+  if (bytes == 2)
+  {
+    memcpy(&h, in, 2);
+    return h;
+  }
+  memcpy(&value, in, 4);
+  return value;
+}
+
+/* Maps small negative and positive differences
+ * to small unsigned values (0, -1, 1, -2, ...).
+ */
+static uint32_t zigzag(int32_t value)
+{
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value)
+{
+  return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+// INT COLUMNS.
+
+static int encode_int(const char *values, int rows, char *out, int room)
+{
+  int32_t min, max, prev, value;
+  uint32_t max_delta = 0;
+  int sizes[ENCODINGS], runs = 1, run = 1, for_bytes, delta_bytes;
+  int encoding = ENCODING_PLAIN, i, pos;
+
+  min = max = prev = int_at(values, 0);
+  for (i = 1; i < rows; i++)
+  {
+    value = int_at(values, i);
+    if (value < min)
+      min = value;
+    if (value > max)
+      max = value;
+    if (zigzag((int32_t)((uint32_t)value - (uint32_t)prev)) > max_delta)
+      max_delta = zigzag((int32_t)((uint32_t)value - (uint32_t)prev));
+    if (value != prev || run == RUN_MAX)
+    {
+      runs++;
+      run = 0;
+    }
+    run++;
+    prev = value;
+  }
+  for_bytes = bytes_for((uint32_t)max - (uint32_t)min);
+  delta_bytes = bytes_for(max_delta);
+
+  sizes[ENCODING_PLAIN] = rows * (int)sizeof(int);
+  sizes[ENCODING_FOR] = 5 + rows * for_bytes;
+  sizes[ENCODING_DELTA] = 5 + (rows - 1) * delta_bytes;
+  sizes[ENCODING_RLE] = runs * 6;
+  for (i = ENCODING_FOR; i <= ENCODING_RLE; i++)
+    if (sizes[i] < sizes[encoding])
+      encoding = i;
+  if (1 + sizes[encoding] > room)
+    return -1;
+
+  out[0] = (char)encoding;
+  pos = 1;
+  switch (encoding)
+  {
+  case ENCODING_PLAIN:
+    memcpy(out + pos, values, (size_t)rows * sizeof(int));
+    pos += rows * (int)sizeof(int);
+    break;
+  case ENCODING_FOR:
+    memcpy(out + pos, &min, 4);
+    out[pos + 4] = (char)for_bytes;
+    pos += 5;
+    for (i = 0; i < rows; i++, pos += for_bytes)
+      put_uint(out + pos, (uint32_t)int_at(values, i) - (uint32_t)min, for_bytes);
+    break;
+  case ENCODING_DELTA:
+    prev = int_at(values, 0);
+    memcpy(out + pos, &prev, 4);
+    out[pos + 4] = (char)delta_bytes;
+    pos += 5;
+    for (i = 1; i < rows; i++, pos += delta_bytes)
+    {
+      value = int_at(values, i);
+      put_uint(out + pos, zigzag((int32_t)((uint32_t)value - (uint32_t)prev)), delta_bytes);
+      prev = value;
+    }
+    break;
+  case ENCODING_RLE:
+    for (i = 0; i < rows; i += run, pos += 6)
+    {
+      value = int_at(values, i);
+      for (run = 1; i + run < rows && run < RUN_MAX && int_at(values, i + run) == value; run++)
+        ;
+      memcpy(out + pos, &value, 4);
+      put_uint(out + pos + 4, (uint32_t)run, 2);
+    }
+    break;
+  }
+  return pos;
+}
+
+static int decode_int(const char *in, int rows, char *values)
+{
+  int32_t base, value;
+  int bytes, i, run, pos = 1;
+
+  switch (in[0])
+  {
+  case ENCODING_PLAIN:
+    memcpy(values, in + pos, (size_t)rows * sizeof(int));
+    pos += rows * (int)sizeof(int);
+    break;
+  case ENCODING_FOR:
+    memcpy(&base, in + pos, 4);
+    bytes = in[pos + 4];
+    pos += 5;
+    for (i = 0; i < rows; i++, pos += bytes)
+    {
+      value = (int32_t)((uint32_t)base + get_uint(in + pos, bytes));
+      memcpy(values + (size_t)i * sizeof(int), &value, sizeof(int));
+    }
+    break;
+  case ENCODING_DELTA:
+    memcpy(&value, in + pos, 4);
+    bytes = in[pos + 4];
+    pos += 5;
+    memcpy(values, &value, sizeof(int));
+    for (i = 1; i < rows; i++, pos += bytes)
+    {
+      value = (int32_t)((uint32_t)value + (uint32_t)unzigzag(get_uint(in + pos, bytes)));
+      memcpy(values + (size_t)i * sizeof(int), &value, sizeof(int));
+    }
+    break;
+  case ENCODING_RLE:
+    for (i = 0; i < rows; pos += 6)
+    {
+      memcpy(&value, in + pos, 4);
+      for (run = (int)get_uint(in + pos + 4, 2); run > 0; run--, i++)
+        memcpy(values + (size_t)i * sizeof(int), &value, sizeof(int));
+    }
+    break;
+  }
+  return pos;
+}
+
+// CHAR COLUMNS.
+
+static int encode_char(int width, const char *values, int rows,
+                       char *out, int room)
+{
+  int sizes[ENCODINGS], dict[DICT_MAX_VALUES], num_dict = 0;
+  int lb = length_bytes(width), encoding = ENCODING_PLAIN;
+  int i, j, len, run = 0, pos;
+  const char *value;
+  unsigned char *codes = malloc(rows > 0 ? rows : 1);
+
+  if (codes == NULL)
+  {
+    perror("Column codes.");
+    exit(EXIT_FAILURE);
+  }
+
+  sizes[ENCODING_PLAIN] = rows * width;
+  sizes[ENCODING_TRIM] = 0;
+  sizes[ENCODING_RLE] = 0;
+  sizes[ENCODING_DICT] = 2 + rows;
+  for (i = 0; i < rows; i++)
+  {
+    value = values + (size_t)i * width;
+    len = value_length(value, width);
+    sizes[ENCODING_TRIM] += lb + len;
+    if (i == 0 || run == RUN_MAX || memcmp(value, value - width, width) != 0)
+    {
+      sizes[ENCODING_RLE] += lb + len + 2;
+      run = 0;
+    }
+    run++;
+
+    // linear search, the dictionary is small or given up on
+    if (sizes[ENCODING_DICT] == INT_MAX)
+      continue;
+    for (j = 0; j < num_dict; j++)
+      if (memcmp(values + (size_t)dict[j] * width, value, width) == 0)
+        break;
+    if (j == num_dict)
+    {
+      if (num_dict == DICT_MAX_VALUES)
+      {
+        sizes[ENCODING_DICT] = INT_MAX;
+        continue;
+      }
+      dict[num_dict++] = i;
+      sizes[ENCODING_DICT] += lb + len;
+    }
+    codes[i] = (unsigned char)j;
+  }
+  if (sizes[ENCODING_TRIM] < sizes[encoding])
+    encoding = ENCODING_TRIM;
+  if (sizes[ENCODING_RLE] < sizes[encoding])
+    encoding = ENCODING_RLE;
+  if (sizes[ENCODING_DICT] < sizes[encoding])
+    encoding = ENCODING_DICT;
+  if (1 + sizes[encoding] > room)
+  {
+    free(codes);
+    return -1;
+  }
+
+  out[0] = (char)encoding;
+  pos = 1;
+  switch (encoding)
+  {
+  case ENCODING_PLAIN:
+    memcpy(out + pos, values, (size_t)rows * width);
+    pos += rows * width;
+    break;
+  case ENCODING_TRIM:
+    for (i = 0; i < rows; i++)
+    {
+      value = values + (size_t)i * width;
+      len = value_length(value, width);
+      put_uint(out + pos, (uint32_t)len, lb);
+      memcpy(out + pos + lb, value, len);
+      pos += lb + len;
+    }
+    break;
+  case ENCODING_RLE:
+    for (i = 0; i < rows; i += run)
+    {
+      value = values + (size_t)i * width;
+      for (run = 1; i + run < rows && run < RUN_MAX && memcmp(value + (size_t)run * width, value, width) == 0; run++)
+        ;
+      len = value_length(value, width);
+      put_uint(out + pos, (uint32_t)len, lb);
+      memcpy(out + pos + lb, value, len);
+      put_uint(out + pos + lb + len, (uint32_t)run, 2);
+      pos += lb + len + 2;
+    }
+    break;
+  case ENCODING_DICT:
+    put_uint(out + pos, (uint32_t)num_dict, 2);
+    pos += 2;
+    for (j = 0; j < num_dict; j++)
+    {
+      value = values + (size_t)dict[j] * width;
+      len = value_length(value, width);
+      put_uint(out + pos, (uint32_t)len, lb);
+      memcpy(out + pos + lb, value, len);
+      pos += lb + len;
+    }
+    memcpy(out + pos, codes, rows);
+    pos += rows;
+    break;
+  }
+  free(codes);
+  return pos;
+}
+
+static int decode_char(const char *in, int width, int rows, char *values)
+{
+  const char *dict[DICT_MAX_VALUES];
+  int dict_len[DICT_MAX_VALUES], num_dict;
+  int lb = length_bytes(width), i, j, len, run, pos = 1;
+
+  if (in[0] == ENCODING_PLAIN)
+  {
+    memcpy(values, in + pos, (size_t)rows * width);
+    return pos + rows * width;
+  }
+
+  memset(values, '\0', (size_t)rows * width);
+  switch (in[0])
+  {
+  case ENCODING_TRIM:
+    for (i = 0; i < rows; i++)
+    {
+      len = (int)get_uint(in + pos, lb);
+      memcpy(values + (size_t)i * width, in + pos + lb, len);
+      pos += lb + len;
+    }
+    break;
+  case ENCODING_RLE:
+    for (i = 0; i < rows;)
+    {
+      len = (int)get_uint(in + pos, lb);
+      for (run = (int)get_uint(in + pos + lb + len, 2); run > 0; run--, i++)
+        memcpy(values + (size_t)i * width, in + pos + lb, len);
+      pos += lb + len + 2;
+    }
+    break;
+  case ENCODING_DICT:
+    num_dict = (int)get_uint(in + pos, 2);
+    pos += 2;
+    for (j = 0; j < num_dict; j++)
+    {
+      dict_len[j] = (int)get_uint(in + pos, lb);
+      dict[j] = in + pos + lb;
+      pos += lb + dict_len[j];
+    }
+    for (i = 0; i < rows; i++)
+    {
+      j = (unsigned char)in[pos + i];
+      memcpy(values + (size_t)i * width, dict[j], dict_len[j]);
+    }
+    pos += rows;
+    break;
+  }
+  return pos;
+}
+
+// INTERFACE.
+
+/* Writes the rows values of a column with the
+ * smallest encoding, returning the bytes written,
+ * or -1 if even that does not fit in room bytes.
+ */
+int encode_column(char type, int width, const char *values, int rows,
+                  char *out, int room)
+{
+  if (rows == 0)
+  {
+    if (room < 1)
+      return -1;
+    out[0] = ENCODING_PLAIN;
+    return 1;
+  }
+  if (type == COLUMN_INT)
+    return encode_int(values, rows, out, room);
+  return encode_char(width, values, rows, out, room);
+}
+
+/* Reads an encoded column back into rows values
+ * of width bytes, returning the bytes read.
+ */
+int decode_column(const char *in, char type, int width, int rows,
+                  char *values)
+{
+  if (rows == 0)
+    return 1;
+  if (type == COLUMN_INT)
+    return decode_int(in, rows, values);
+  return decode_char(in, width, rows, values);
+}
+
+const char *encoding_name(int encoding)
+{
+  return encoding >= 0 && encoding < ENCODINGS ? encoding_names[encoding] : "?";
+}
@@ -0,0 +1,53 @@
+/*
+ *  compress.h
+ *
+ *  Column encodings for compressed table pages.
+ *
+ *  A column of a page is given as its values in
+ *  sequence, each as wide as the column (an int,
+ *  or a char padded with '\0'), and is written
+ *  with the smallest of the encodings of its
+ *  type:
+ *
+ *  int:  plain; frame of reference, the offsets
+ *        from the smallest value in 1, 2 or 4
+ *        bytes; delta, the zigzag differences
+ *        from the previous value in 1, 2 or 4
+ *        bytes; and run length.
+ *  char: plain; trimmed, the length and the
+ *        characters without the padding;
+ *        dictionary, up to DICT_MAX_VALUES
+ *        distinct values and one byte per row;
+ *        and run length.
+ *
+ *  The first byte of an encoded column is its
+ *  encoding.  The number of rows is not stored,
+ *  the page keeps it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Column types, as in the table header.
+#define COLUMN_INT 'I'
+#define COLUMN_CHAR 'C'
+
+// Encodings, the first byte of a column.
+#define ENCODING_PLAIN 0
+#define ENCODING_FOR 1
+#define ENCODING_DELTA 2
+#define ENCODING_RLE 3
+#define ENCODING_TRIM 4
+#define ENCODING_DICT 5
+#define ENCODINGS 6
+
+// Most distinct values of a dictionary column.
+#define DICT_MAX_VALUES 256
+
+// FUNCTION PROTOTYPES.
+
+int encode_column(char type, int width, const char *values, int rows,
+                  char *out, int room);
+int decode_column(const char *in, char type, int width, int rows,
+                  char *values);
+const char *encoding_name(int encoding);
@@ -1,11 +1,81 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include "bpt.h"
+#include "bloom.h"
+#include "bufferpool.h"
+#include "compress.h"
+#include "wal.h"
+#include "sql.h"
+
+#define PAGE_SIZE 8192 // tamanho das paginas das tabelas e do indice
+
+#define PK_MAGIC 0x54424B50 // identifica o pk.dat paginado ("PKBT")
+
+#define BLOOM_MAGIC 0x4D4C4250 // identifica o pk.bloom ("PBLM")
+
+// maior ordem da B+ da pk em que um no folha (cabecalho, chaves e registros)
+// cabe em uma pagina do pk.dat, usada quando a tabela nao define outra
+#define PK_ORDER ((PAGE_SIZE - 3 * (int)sizeof(int)) / (3 * (int)sizeof(int)) + 1)
+
+// quantidade de nos das arvores B+ mantidos em memoria. Passando disso, apos
+// um comando, os nos sao gravados e os abaixo das raizes saem da memoria,
+// voltando a ser lidos do pk.dat quando visitados
+#define PK_CACHE_NODES 4096
+
+// quantidade de paginas livres guardadas em uma pagina da lista do pk.dat
+#define PK_FREE_PER_PAGE (PAGE_SIZE / (int)sizeof(int) - 2)
+
+// ocupacao (%) dos nos quando a arvore eh montada de uma vez (bulk load)
+#define PK_FILL_FACTOR 90
+
+// versao do formato dos registros das tabelas novas:
+// 1 - campos na ordem da tabela, varchar terminado por '$'
+// 2 - campos de tamanho fixo, tabela de offsets dos varchar e os varchar
+//     como tamanho (2 bytes) seguido dos caracteres
+#define ROW_FORMAT 2
+
+// versao do formato das paginas das tabelas novas:
+// 1 - cabecalho memFree, next, qtdItems e itens de 12 bytes (offset, totalLen, writed)
+// 2 - cabecalho com a quantidade de slots e o inicio dos dados (2 bytes cada)
+//     e slots de 4 bytes: offset e tamanho, com SLOT_USED no bit mais alto
+#define PAGE_FORMAT 2
+
+// formato das paginas das tabelas criadas com a opcao "pax": cabecalho com
+// a quantidade de registros e a capacidade da pagina (2 bytes cada) e uma
+// minipagina por campo, com os valores do campo de todos os registros em
+// sequencia. O offset dos registros no indice eh o numero do registro
+#define PAGE_FORMAT_PAX 3
+
+// formato das paginas das tabelas criadas com a opcao "compress": cabecalho
+// com a quantidade de registros, a quantidade de registros codificados e o
+// fim dos dados codificados (2 bytes cada), seguido pelos campos dos
+// registros codificados, cada um com a menor codificacao de compress.h. Os
+// registros ainda nao codificados ficam inteiros no final da pagina e sao
+// codificados juntos quando o proximo nao cabe mais. O offset dos registros
+// no indice eh o numero do registro
+#define PAGE_FORMAT_COMPRESSED 4
+
+// maximo de registros em uma pagina comprimida
+#define COMPRESSED_MAX_ROWS 4096
+
+#define SLOT_USED 0x8000 // slot com registro gravado
+#define SLOT_LEN_MASK 0x7FFF
+
+// tamanho dos trechos do arquivo do copy, cada um lido por um worker
+#define COPY_CHUNK_BYTES (16 * 1024 * 1024)
+
+// maximo de workers do copy rodando juntos
+#define COPY_MAX_THREADS 16
 
 
 /*Example:
@@ -23,6 +93,12 @@ typedef struct Header {
     int qtdItems; // quantidade de itens
 } header;
 
+// slot de uma pagina no formato 2
+typedef struct Slot {
+    unsigned short offset; // posicao do registro na pagina
+    unsigned short len; // tamanho do registro, com SLOT_USED no bit mais alto
+} slot;
+
 typedef struct Item {
     int offset;
     int totalLen; // tamanho total do elemento 
@@ -37,89 +113,315 @@ typedef struct Attribute { // atributo da tabela sql, coluna da tabela sql
     int ai; // define se o atributo é ai
 } attribute;
 
+// posicao dos campos de um registro no formato 2, calculada uma vez por
+// comando a partir dos atributos da tabela
+typedef struct RowLayout {
+    int format; // versao do formato dos registros da tabela
+    int offset[64]; // campo fixo: posicao no registro; varchar: indice na tabela de offsets
+    int qtdVar; // quantidade de campos varchar
+    int varTable; // posicao da tabela de offsets, apos os campos fixos
+} rowLayout;
+
+// entrada (chave e registro) do pk.dat no formato antigo
+typedef struct PkEntry {
+    int key;
+    record rec;
+} pkEntry;
+
+// pk de um registro de um insert, ordenada para achar as repetidas
+typedef struct PkRow {
+    int key;
+    long row; // posicao do registro no insert
+} pkRow;
+
+// pagina 0 do pk.dat, as demais paginas guardam um no da arvore cada
+typedef struct PkMeta {
+    int magic; // PK_MAGIC
+    int order; // ordem com que a arvore foi gravada
+    int root; // pagina da raiz (0 = arvore vazia)
+    int qtdPages; // quantidade de paginas do arquivo, incluindo a meta
+    int qtdKeys; // quantidade de chaves
+    int freeList; // primeira pagina da lista de paginas livres (0 = nenhuma)
+} pkMeta;
+
+// cabecalho do pk.bloom, seguido pelos blocos do filtro
+typedef struct BloomMeta {
+    int magic; // BLOOM_MAGIC
+    int numBlocks; // quantidade de blocos de 64 bytes
+    int capacity; // quantidade de chaves para a qual o filtro foi dimensionado
+    int numKeys; // quantidade de chaves adicionadas
+} bloomMeta;
+
+// indice (B+) de uma tabela. A raiz fica em memoria durante toda a execucao
+// e os demais nos sao lidos do pk.dat quando visitados
+typedef struct TableIndex {
+    char tableName[500]; // nome da tabela dona do indice
+    int fd; // pk.dat aberto para a leitura dos nos
+    node *root; // raiz da arvore B+ da pk
+    pkMeta meta; // pagina 0 do pk.dat
+    node *lastLeaf; // folha mais a direita, onde entram as chaves ai
+    bloom *filter; // filtro de Bloom da pk (NULL quando a tabela nao usa)
+    node *dirtyNodes; // nos alterados desde o ultimo checkpoint
+    int *freePages; // paginas do pk.dat fora da arvore gravada, reaproveitadas no checkpoint
+    int qtdFree;
+    int freeCapacity;
+    int *listPages; // paginas da lista de paginas livres gravada
+    int qtdList;
+    struct TableIndex *next; // proximo indice da lista
+} tableIndex;
+
+// cabecalho de um registro do wal.log, gravado por pagina preenchida por um
+// insert: os valores do header.dat e a chave do indice apos o insert,
+// seguido pelo nome da tabela, pelos trechos alterados das paginas (pagina,
+// posicao e tamanho do trecho, seguidos pelos bytes novos) e, quando o
+// registro tem mais de uma chave, pelas chaves (entry)
+typedef struct WalInsert {
+    int aiValue; // valor do ai
+    int qtdPages; // quantidade de paginas
+    int lastPage; // ultima pagina
+    int qtdKeys; // chaves inseridas no indice: a chave abaixo se for 1, as do final do registro se mais
+
+    int key;
+    int page; // pagina do registro inserido
+    int offset; // offset do registro inserido
+    int nameLen; // tamanho do nome da tabela
+} walInsert;
+
+// registro do wal.log sendo montado durante um insert, com espaco para as
+// alteracoes de ate duas paginas (a ultima pagina e a nova pagina)
+typedef struct WalChange {
+    int len; // bytes usados em data
+    int nameLen; // tamanho do nome da tabela
+    char data[sizeof(walInsert) + 500 + 5 * PAGE_SIZE];
+} walChange;
+
+// trecho alterado de uma pagina, no registro do wal.log
+typedef struct WalRange {
+    int page;
+    unsigned short offset;
+    unsigned short len;
+} walRange;
+
+// esquema de uma tabela mantido em memoria durante toda a execucao: os
+// campos e formatos do header.dat, lidos uma unica vez, e os valores que
+// mudam a cada insert, gravados de volta no header.dat (que fica aberto)
+typedef struct TableSchema {
+    char tableName[500];
+    int qtdFields;
+    attribute attributes[64];
+    int rowFormat; // versao do formato dos registros
+    int pageFormat; // versao do formato das paginas
+    rowLayout layout;
+    int pkFieldExist;
+    int aiFieldExist;
+    int aiValue; // valor do ai
+    int qtdPages; // quantidade de paginas
+    int lastPage; // ultima pagina, onde entram os proximos registros
+    long countersPos; // posicao do valor do ai no header.dat
+    FILE *header;
+    tableIndex *index; // indice da pk
+    struct TableSchema *next; // proximo esquema da lista
+} tableSchema;
+
+// comando guardado por "prepare", com o seu texto (para onde apontam as
+// views da arvore) e o esquema da tabela, resolvido uma unica vez
+typedef struct PreparedStatement {
+    char name[100];
+    char *text;
+    sql_statement statement;
+    tableSchema *schema;
+    struct PreparedStatement *next;
+} preparedStatement;
+
+// trecho do arquivo do copy, lido por um worker. A fase 1 conta as linhas e
+// os registros e guarda as pks, a fase 2 grava os registros em paginas
+// proprias do trecho (as chaves apontam para o indice da pagina em pages)
+typedef struct CopyChunk {
+    tableSchema *schema;
+    const char *start; // inicio do trecho, no inicio de uma linha
+    const char *end;
+    int qtdLines; // linhas lidas, incluindo as vazias
+    long qtdRows; // registros do trecho
+    long firstRow; // posicao do primeiro registro do trecho no arquivo
+    pkRow *rows; // pks dos registros (tabela com pk sem ai)
+    char *skip; // registros do arquivo descartados pela pk repetida
+    long qtdAiRows; // registros que recebem um valor do ai (os que cabem em uma pagina vazia)
+    int aiBase; // valor do ai antes do primeiro registro do trecho
+    char **pages;
+    int qtdPages;
+    int pagesCapacity;
+    entry *keys; // chaves gravadas
+    long qtdKeys;
+    long qtdInserted;
+    long qtdTooLarge; // registros maiores que uma pagina vazia
+    char error[200]; // primeira linha invalida do trecho
+} copyChunk;
+
+// tabela alterada desde o ultimo checkpoint do wal.log, cujos arquivos
+// precisam ser sincronizados antes de esvazia-lo
+typedef struct ChangedTable {
+    char tableName[500];
+    struct ChangedTable *next;
+} changedTable;
+
 // 0 - Oculta debug
 // 1 - Habilita debug
 int debug = 0;
 
-void getTableName(char *sql, char *name);
+// lista com os indices ja carregados, cada pk.dat eh lido uma unica vez
+tableIndex *indexCache = NULL;
+
+// tabelas alteradas desde o ultimo checkpoint do wal.log
+changedTable *changedTables = NULL;
+
+// lista com os esquemas ja lidos, cada header.dat eh lido uma unica vez
+tableSchema *schemaCache = NULL;
 
-int buildHeader(char *sql, char *tableName, int qtdPages);
+// comandos preparados
+preparedStatement *preparedStatements = NULL;
+
+int buildHeader(sql_statement *statement, char *tableName, int qtdPages);
 
 void revertTableCreation(char *tableName);
 
-void generatePkFile(char *tableName, char *fieldName);
+void generatePkFile(char *tableName, int pkOrder);
+
+int getIndexOrder(sql_statement *statement);
+
+int getBloomOption(sql_statement *statement);
+
+int getPageFormat(sql_statement *statement);
+
+void generateBloomFile(char *tableName);
 
 void getAllAtributes(char *sql, char *attributes);
 
 void leArquivo(char *tableName);
 
-node *loadTableBPT(node *root, char *tableName); 
+void loadTableBPT(tableIndex *index);
 
-void saveTableBPT(node *root, char *tableName);
+node *loadBPTNode(node *parent, int pageNo);
 
-int extreactPkValueFromSQL(char *sql);
+void trimAllTables(void);
 
-/**
- * Separa a operação do restante da string SQL 
- * - select ou
- * - create ou
- * - insert ou
- * - delete
- */
-void getOp(char *sql, char *operation) {
-    char sqlCopy[1000], *token;
-    char key[2] = " ";
-    char *ptr;
+void flushTableBPT(tableIndex *index);
 
-    memset(sqlCopy, '\0', sizeof(sqlCopy));
+void addFreeBPTPage(tableIndex *index, int pageNo);
 
-    strcpy(sqlCopy, sql);
+void beginTableChange(tableIndex *index);
 
-    token = strtok(sqlCopy, key);
+void endTableChange(tableIndex *index);
 
-    strcpy(operation, token);
-    
-    if((ptr = strchr(operation, '\n')) != NULL)
-        *ptr = '\0';
-}
+void replayTableLog(tableIndex *index);
 
-void createPage(char *tableName, int numPage) {
-    //cria pagina no disco com tamanho de 8kb
-  	header head;
-    head.memFree = 8180; // quantidade de memória livre na página
-	head.next = 8191; // usado na criação do arquivo da pagina, para indicar onde sera inserido o proximo elemento
-    head.qtdItems = 0; //usado na criação do arquivo da pagina, incialemnte cria a pagina zerada
+void checkpointTableBPT(tableIndex *index);
+
+void checkpointAllTables(void);
+
+tableIndex *getTableIndex(char *tableName);
+
+tableSchema *getTableSchema(char *tableName);
+
+void saveTableSchema(tableSchema *schema);
+
+tableSchema *statementSchema(sql_statement *statement);
+
+int checkInsertValues(tableSchema *schema, sql_statement *statement);
+
+long markDuplicateRows(tableIndex *index, pkRow rows[], long qtdRows, char skip[]);
+
+int markDuplicateKeys(tableSchema *schema, sql_token values[], int qtdRows, char skip[]);
+
+int rowInsertSize(tableSchema *schema, sql_token values[]);
+
+int writeRow(tableSchema *schema, char *page, sql_token values[], int insertSize, int aiValue, int *pkValue);
+
+void insertRows(tableSchema *schema, sql_token values[], int qtdRows);
+
+void printRow(char *page, int pageFormat, attribute attributes[], int qtdFields, rowLayout *layout, char *rows, int qtdSlots, int offset);
+
+int checkSelectKey(tableSchema *schema, sql_statement *statement);
+
+void selectByKey(sql_statement *statement, tableSchema *schema);
+
+void selectRows(tableSchema *schema, sql_statement *statement);
+
+void selectFrom(sql_statement *statement);
+
+void *copyScanChunk(void *arg);
+
+char *copyNewPage(copyChunk *chunk);
+
+void *copyEncodeChunk(void *arg);
+
+void runCopyWorkers(copyChunk chunks[], int qtdChunks, void *(*work)(void *));
+
+void copyRows(tableSchema *schema, copyChunk chunks[], int qtdChunks, int qtdThreads, long qtdRows);
+
+void loadTableBloom(tableIndex *index);
+
+void saveTableBloom(tableIndex *index);
+
+void addBloomSubtree(bloom *filter, node *n);
+
+void rebuildTableBloom(tableIndex *index, int capacity);
+
+void addTableBloom(tableIndex *index, int key);
+
+void addTableBloomKeys(tableIndex *index, entry keys[], long qtdKeys);
+
+void initPage(char *page, int pageFormat);
+
+int pageFits(char *page, int pageFormat, int size);
+
+int addPageRow(char *page, int pageFormat, int size);
+
+int pageRowCount(char *page, int pageFormat);
+
+int pageRowOffset(char *page, int pageFormat, int slotNo);
+
+char *paxField(char *page, rowLayout *layout, attribute attributes[], int slotNo, int field);
+
+int tailRowOffset(char *page, int slotNo, int size);
 
-  	struct stat stateDir = {0};
+char *decodePage(char *page, attribute attributes[], int qtdFields, rowLayout *layout);
 
-    char pageName[600]; 
+int compressPage(char *page, attribute attributes[], int qtdFields, rowLayout *layout);
+
+void tableStats(sql_statement *statement);
+
+void walBegin(walChange *change, char *tableName);
+
+void walPageChange(walChange *change, char *before, char *page, int numPage);
+
+long walEnd(walChange *change, walInsert *head, entry keys[], int qtdKeys);
+
+void redoInsert(const char *data, int len);
+
+void addChangedTable(char *tableName);
+
+void syncTableFile(char *tableName, char *fileName);
+
+void checkpointWal(void);
+
+void buildRowLayout(rowLayout *layout, attribute attributes[], int qtdFields, int format);
+
+char *rowField(char *row, rowLayout *layout, attribute attributes[], int field, int *len);
+
+void createPage(char *tableName, int numPage, int pageFormat) {
+    //cria pagina no disco com tamanho de 8kb
 
     //printf("tableName: %s\n\n", tableName);
     //printf("NumPage: %d\n\n", numPage);
 
-  	//define o nome da pagina na variavel pageName, com base nos parametros informados na função
-    snprintf(pageName, sizeof(pageName), "%s/page%d.dat", tableName, numPage); 
-
-    FILE *page = fopen(pageName, "wb"); //cria o arquivo da pagina no modo de escrita binária
-    fwrite(&head.memFree, sizeof(int), 1, page);  // free
-    fwrite(&head.next, sizeof(int), 1, page);     // onde inserir o proximo elemento
-    fwrite(&head.qtdItems, sizeof(int), 1, page);// n elementos
-    fclose(page); // fecha o arquivo
-    
-  	if(page == NULL) { //caso tenha ocorrido algum erro na criação da pagina
-        printf("Failed to create page\n");
-        return;
-    }
+    char *page = pin_new_page(tableName, numPage); //cria a pagina no buffer pool, gravada no fim do comando
+    initPage(page, pageFormat);
+    page[8191] = '0'; // ultima pagina da tabela
+    unpin_page(tableName, numPage, true);
 }
 
 
-void createTable(char *sql) {
-	// cria cabeçalho da página
-    header head;
-    head.memFree = 8180; // 8kb
-    head.next = 8191; // próxima página
-    head.qtdItems = 0; // qtd de registros da tabela
-
+void createTable(sql_statement *statement) {
 	// delimitador de fim da página
     char special = '0';
 
@@ -127,9 +429,11 @@ void createTable(char *sql) {
 
 	char tableName[500]; // define nome da tabela com 500 caracteres
   	char pageName[600]; // define nome da página com 500 caracteres
-  	memset(tableName, '\0', sizeof(tableName)); // '\0' apos nome da tabela
 
-	getTableName(sql, tableName); // pega o nome da tabela
+    if(!sql_view_copy(statement->table, tableName, sizeof(tableName))) {
+        printf("Table name is too long\n");
+        return;
+    }
 
 	// status do arquivo -1 = tabela não existe
   	if(stat(tableName, &stateDir) == -1) {
@@ -143,25 +447,16 @@ void createTable(char *sql) {
       	FILE *headerPage = fopen(pageName, "wb");
         fclose(headerPage);
         
-	    // cria arquivo de página da tabela
-      	snprintf(pageName, sizeof(pageName), "%s/page1.dat", tableName);  
-      	FILE *page = fopen(pageName, "wb");
-        fwrite(&head.memFree, sizeof(int), 1, page);  // quantidade de memória disponível
-        fwrite(&head.next, sizeof(int), 1, page);     // onde inserir o proximo elemento
-        fwrite(&head.qtdItems, sizeof(int), 1, page); // n elementos
+	    // cria a primeira página da tabela no buffer pool
+      	char *page = pin_new_page(tableName, 1);
+        initPage(page, getPageFormat(statement)); // cabeçalho da página vazia
         
       	// insere caracter especial ao final da página para indicar fim de página
       	// especial = '0'
-      	fseek(page, 8191, SEEK_SET);
-        fwrite(&special, 1, 1, page);
-      	fclose(page);
-        
-      	if(page == NULL) {
-            printf("Failed to create page\n");
-            return;
-        }
+        page[8191] = special;
+        unpin_page(tableName, 1, true);
 	
-    	if(buildHeader(sql, tableName, 1) == 1){
+    	if(buildHeader(statement, tableName, 1) == 1){
             // a tabela eh invalida e deve ser revertida
             revertTableCreation(tableName);
         }
@@ -173,205 +468,269 @@ void createTable(char *sql) {
 void revertTableCreation(char *tableName){
   	char pageName[600]; // define nome da página com 500 caracteres
 
+    // descarta as paginas da tabela que estao no buffer pool
+    discard_pages(tableName);
+
     // Deleta header
     snprintf(pageName, sizeof(pageName), "%s/header.dat", tableName);
     remove(pageName);
 
-    // Deleta pagina
+    // Deleta paginas
+    snprintf(pageName, sizeof(pageName), "%s/data.dat", tableName);  
+    remove(pageName);
     snprintf(pageName, sizeof(pageName), "%s/page1.dat", tableName);  
     remove(pageName);
 
+    // Deleta indice
+    snprintf(pageName, sizeof(pageName), "%s/pk.dat", tableName);  
+    remove(pageName);
+
+    // Deleta filtro de Bloom
+    snprintf(pageName, sizeof(pageName), "%s/pk.bloom", tableName);  
+    remove(pageName);
+
+    // Deleta o pk.log deixado por versoes anteriores
+    snprintf(pageName, sizeof(pageName), "%s/pk.log", tableName);  
+    remove(pageName);
+
     rmdir(tableName);
 
     if(debug) printf("Table %s was deleted\n", tableName);
 }
 
-int buildHeader(char *sql, char *tableName, int qtdPages) {
+int buildHeader(sql_statement *statement, char *tableName, int qtdPages) {
     int invalidTable = 0; // flag principal, se retornar 1, a tabela eh revertida
-    char fieldName[15], pkFieldName[15], fieldType; //nome e tipo do campo
-    char matchPKField[18], matchAIField[21]; // armazena a str de busca para verificar PK ou AI
-    int fieldSize, isPkField, isAiField, i = 0; //tamanho do campo e variavel auxiliar
-    int isValidField = 0, isDynamicSizeType = 0, pkDefined = 0; // flags
-    int initialAiValue = 0;
-
-    char sqlCopy[1000], attribute[50], pageName[600];  
-    char *token, *tokenAttribute;
-
-    memset(fieldName, '\0', sizeof(fieldName));  //limpa a string do field name
-
-    strcpy(sqlCopy, sql); //cria um arquivo auxiliar para o script sql
+    char fieldName[15]; //nome do campo
+    int isPkField, isAiField, i = 0; //variavel auxiliar
+    int pkDefined = 0; // flags
+    int initialAiValue = 0, pkOrder, rowFormat = ROW_FORMAT, pageFormat = getPageFormat(statement);
+    char pageName[600];
+    sql_column *column;
 
     snprintf(pageName, sizeof(pageName), "%s/header.dat", tableName); //define o nome do arquvio de cabeçalho
     FILE *headerPage = fopen(pageName, "rb+"); //instancia o arquvio de cabeçalho em modo de escrita e leitura
 
-    fwrite(&i, sizeof(int), 1, headerPage); //escreve o conteudo de i (0) no inicio do arquivo de cabeçalho   
-
-	// encontra o primeiro parentese na string SQL para e separa em tokens
-	// após o primeiro parentese estarão as definições de atributos da tabela
-  	// ex: ( int id, varchar nome )
-    token = strtok(sqlCopy, "(");  
-    token = strtok(NULL, "()[], "); 
-
-    while(token != NULL) { // enquanto existir tokens
-        isValidField = 0;
-        isDynamicSizeType = 0;
-        isPkField = 0;
-        isAiField = 0;
-
-        if(strcmp(token, "char") == 0) { // compara se o token é um char
-            isValidField = 1;
-            isDynamicSizeType = 1;
-            fieldType = 'C'; // define o tipo do atributo como C
-        } else if(strcmp(token, "int") == 0) { // compara se é int
-            isValidField = 1;
-            fieldType = 'I'; // tipo do atributo 
-            token = strtok(NULL, "()[], ");
-            fieldSize = sizeof(int); // tamanho do atributo igual ao tamanho de um inteiro, 4bytes
-        } else if(strcmp(token, "varchar") == 0) { // compara se é varchar
-            isValidField = 1;
-            isDynamicSizeType = 1;
-            fieldType = 'V'; // tipo do atributo 
-        }
-
-        if(isValidField){
-            // Field Type
-            fwrite(&fieldType, 1, 1, headerPage); 
-            if(isDynamicSizeType){
-                token = strtok(NULL, "()[], ");
-                fieldSize = atoi(token);
-                token = strtok(NULL, "()[], ");
-            }
-            if(debug) printf("Type: %c\n", fieldType);
-
-            // Filed Size
-            fwrite(&fieldSize, sizeof(int), 1, headerPage);
-            if(debug) printf("Size: %d\n", fieldSize);
-
-            // Field Name
-            strcpy(fieldName, token);
-            fwrite(fieldName, 15, 1, headerPage);
-            if(debug) printf("Name: %s\n", fieldName);
-            
-            // Field Primary Key
-            snprintf(matchPKField, sizeof(matchPKField), "%s pk", fieldName); 
-            if(strstr(sql, matchPKField)){
-                isPkField = 1;
-                if(isDynamicSizeType){
-                    printf("Primary Key must to be an integer type\n");
-                    invalidTable = 1;
-                    break;
-                }
-                if(pkDefined){
-                    printf("Primary Key is already defined\n");
-                    invalidTable = 1;
-                    break;
-                }
-                if(i != 0){
-                    printf("Primary Key must to be the first field\n");
-                    invalidTable = 1;
-                    break;
-                }
-                pkDefined = 1;
-                strcpy(pkFieldName, fieldName);
+    fwrite(&i, sizeof(int), 1, headerPage); //escreve o conteudo de i (0) no inicio do arquivo de cabeçalho
 
-                snprintf(matchAIField, sizeof(matchAIField), "%s pk ai", fieldName); 
-                if(strstr(sql, matchAIField)){
-                    isAiField = 1;
-                }
-            }
+    // os campos ja vem separados na arvore do comando
+    for(int c = 0; c < statement->num_columns; c++) {
+        column = &statement->columns[c];
+        isPkField = column->pk;
+        isAiField = column->ai;
+
+        // o nome eh gravado com ate 14 caracteres, um nome maior nao seria
+        // mais achado pelo nome completo (where do select)
+        if(column->name.len > 14) {
+            printf("Field name %.*s is too long (at most 14 characters)\n", column->name.len, column->name.start);
+            invalidTable = 1;
+            break;
+        }
 
-            fwrite(&isPkField, sizeof(int), 1, headerPage);
-            fwrite(&isAiField, sizeof(int), 1, headerPage);
-            if(debug) printf("Primary Key: %s\n", isPkField ? "true" : "false");
-            if(debug) printf("Auto Increment: %s\n", isAiField ? "true" : "false");
+        if(column->type == 'V' && pageFormat >= PAGE_FORMAT_PAX) {
+            printf("PAX and compressed tables only support int and char fields\n");
+            invalidTable = 1;
+        }
 
-            i++;
+        // Field Type
+        fwrite(&column->type, 1, 1, headerPage);
+        if(debug) printf("Type: %c\n", column->type);
+
+        // Filed Size
+        fwrite(&column->size, sizeof(int), 1, headerPage);
+        if(debug) printf("Size: %d\n", column->size);
+
+        // Field Name, com ate 14 caracteres
+        memset(fieldName, '\0', sizeof(fieldName));
+        memcpy(fieldName, column->name.start, column->name.len);
+        fwrite(fieldName, 15, 1, headerPage);
+        if(debug) printf("Name: %s\n", fieldName);
+
+        // Field Primary Key
+        if(isPkField){
+            if(column->type != 'I'){
+                printf("Primary Key must to be an integer type\n");
+                invalidTable = 1;
+                break;
+            }
+            if(pkDefined){
+                printf("Primary Key is already defined\n");
+                invalidTable = 1;
+                break;
+            }
+            if(i != 0){
+                printf("Primary Key must to be the first field\n");
+                invalidTable = 1;
+                break;
+            }
+            pkDefined = 1;
         }
 
-        token = strtok(NULL, "()[], "); // procura o fechamento do script create table
+        fwrite(&isPkField, sizeof(int), 1, headerPage);
+        fwrite(&isAiField, sizeof(int), 1, headerPage);
+        if(debug) printf("Primary Key: %s\n", isPkField ? "true" : "false");
+        if(debug) printf("Auto Increment: %s\n", isAiField ? "true" : "false");
+
+        i++;
     }
 
     fwrite(&initialAiValue, sizeof(int), 1, headerPage); // escreve o valor inicial do ai
-    fwrite(&qtdPages, sizeof(int), 1, headerPage); // escreve no arquivo de cabeçalho, a quantidade de paginas daquela tabela 
+    fwrite(&qtdPages, sizeof(int), 1, headerPage); // escreve no arquivo de cabeçalho, a quantidade de paginas daquela tabela
+    fwrite(&qtdPages, sizeof(int), 1, headerPage); // ultima pagina, onde entram os proximos registros
+    fwrite(&rowFormat, sizeof(int), 1, headerPage); // versao do formato dos registros
+    fwrite(&pageFormat, sizeof(int), 1, headerPage); // versao do formato das paginas
     fseek(headerPage, 0, SEEK_SET); // move o ponteiro do arquivo para o inicio
     fwrite(&i, sizeof(int), 1, headerPage); // escreve o numero de atributos daquela tabela
     fclose(headerPage); // fecha o arquivo de cabeçalho
 
 	leArquivo(tableName); // le o arquivo daquela tabela
 
-    if(pkDefined) {
-        generatePkFile(tableName, pkFieldName);
+    pkOrder = getIndexOrder(statement);
+    if(pkOrder == 0)
+        invalidTable = 1;
+
+    if(pkDefined && !invalidTable) {
+        generatePkFile(tableName, pkOrder);
+        if(getBloomOption(statement))
+            generateBloomFile(tableName);
     }
 
     return invalidTable;
 }
 
-void generatePkFile(char *tableName, char *fieldName){
+/**
+ * Le a ordem da B+ da pk das opcoes apos a lista de campos:
+ * - "order N" usa a ordem N
+ * - "order auto [bytes]" usa a maior ordem cujo no em memoria cabe em
+ *   bytes (linha de cache, 4 KB, 8 KB...), por padrao uma pagina
+ * Sem a opcao usa PK_ORDER. Retorna 0 se a opcao for invalida
+ */
+int getIndexOrder(sql_statement *statement){
+    sql_table_options *options = &statement->options;
+    int pkOrder = PK_ORDER, nodeSize = options->node_size > 0 ? options->node_size : PAGE_SIZE;
+
+    if(!options->has_order)
+        return pkOrder;
+
+    if(options->order_auto) {
+        if(nodeSize < (int)node_size(MIN_ORDER)) {
+            printf("Index node size must be at least %d bytes\n", (int)node_size(MIN_ORDER));
+            return 0;
+        }
+        pkOrder = order_for_node_size(nodeSize);
+        if(pkOrder > PK_ORDER)
+            pkOrder = PK_ORDER;
+    } else if(options->order < MIN_ORDER || options->order > PK_ORDER) {
+        printf("Index order must be between %d and %d\n", MIN_ORDER, PK_ORDER);
+        return 0;
+    } else
+        pkOrder = options->order;
+
+    if(debug) printf("Ordem da B+ da pk: %d (no de %d bytes)\n", pkOrder, (int)node_size(pkOrder));
+
+    return pkOrder;
+}
+
+/**
+ * Verifica se a opcao "bloom" foi dada apos a lista de campos, ligando o
+ * filtro de Bloom na frente da verificacao de pk duplicada
+ */
+int getBloomOption(sql_statement *statement){
+    return statement->options.bloom;
+}
+
+/**
+ * Formato das paginas da tabela: PAGE_FORMAT_COMPRESSED com a opcao
+ * "compress" apos a lista de campos, PAGE_FORMAT_PAX com a opcao "pax",
+ * senao PAGE_FORMAT
+ */
+int getPageFormat(sql_statement *statement){
+    if(statement->options.compress)
+        return PAGE_FORMAT_COMPRESSED;
+    if(statement->options.pax)
+        return PAGE_FORMAT_PAX;
+    return PAGE_FORMAT;
+}
+
+void generatePkFile(char *tableName, int pkOrder){
     char pkFileName[600];  
-    int idCount = 0;
+    pkMeta meta = { PK_MAGIC, pkOrder, 0, 1, 0, 0 }; // arvore vazia, apenas a pagina meta
 
     snprintf(pkFileName, sizeof(pkFileName), "%s/pk.dat", tableName); //define o nome do arquivo da pk
     
     if(debug) printf("PK file created at: %s\n", pkFileName);
 
     FILE *filePk = fopen(pkFileName, "wb"); //instancia o arquvio de cabeçalho em modo de escrita e leitura
-    fwrite(&idCount, sizeof(int), 1, filePk); 
+    fwrite(&meta, sizeof(pkMeta), 1, filePk); 
     fclose(filePk); // fecha o arquivo de cabeçalho
 }
 
-int extreactPkValueFromSQL(char *sql){
-    char *token;
-    
-    // Busca o primeiro valor, pois a PK sempre vai ser
-    // o primeiro campo da tabela
-    token = strtok(sql, "(,"); // procura os valores da inserção
-    token = strtok(NULL, "(,"); // continua a busca de onde parou na chamada acima
-
-    if(token == NULL)
-        return 0;
+/**
+ * Cria o pk.bloom com um filtro vazio
+ */
+void generateBloomFile(char *tableName){
+    tableIndex index;
 
-    return atoi(token);
+    strcpy(index.tableName, tableName);
+    index.filter = bloom_create(BLOOM_MIN_CAPACITY);
+    saveTableBloom(&index);
+    bloom_destroy(index.filter);
 }
 
-void insertInto(char *sql, int numPage) { 
-    char sqlCopy[1000], sqlExtractPK[1000], *token, tableName[500], pageName[600], headerName[600], attrSql[1000], attrSqlCopy[1000];
-    char endVarchar = '$', special = ' ', endChar = '\0';
-    int insertSize = 0, qtdFields, nextItem, intVar, nextPage, qtdEndChar = 0;
-    int i = 0, countVarchar = 0, pkInserted;
-    int pkFieldExist = 0, aiFieldExist = 0, aiValue = 0;
-    attribute attributes[64];
-    header head;
-    node *root = NULL;
+/**
+ * Percorre as paginas pelo caracter special ate a ultima, para tabelas
+ * criadas antes do cabecalho guardar a ultima pagina
+ */
+int findLastPage(char *tableName) {
+    int numPage = 1;
+    char special;
 
-    memset(sqlCopy, '\0', sizeof(sqlCopy)); //limpa a variavel que sera usada na copia do script sql
-    strcpy(sqlCopy, sql); // script sql
-    token = strtok(sqlCopy, " () ,"); // quebra o script sql em tokens
+    do {
+        char *page = pin_page(tableName, numPage);
+        special = page[8191];
+        unpin_page(tableName, numPage, false);
+        if(special == '1')
+            numPage++;
+    } while(special == '1');
+
+    return numPage;
+}
 
-    while(token != NULL) { // enquanto existirem tokens
-        // quando o i for igual a 2, o token vai ser o nome da tabela
-        if(i == 2) 
-            strcpy(tableName, token);
-        token = strtok(NULL, " () ,");
-        i++;
+/**
+ * Retorna o esquema da tabela, lendo o header.dat apenas no primeiro acesso,
+ * ou NULL se a tabela nao existe
+ */
+tableSchema *getTableSchema(char *tableName){
+    char headerName[600];
+    tableSchema *schema;
+    attribute *attributes;
+
+    for(schema = schemaCache; schema != NULL; schema = schema->next) {
+        if(strcmp(schema->tableName, tableName) == 0)
+            return schema;
     }
 
     snprintf(headerName, sizeof(headerName), "%s/header.dat", tableName); // define o caminho para o cabeçalho da tabela
     FILE *headerPage = fopen(headerName, "rb+"); // abre o arquivo de cabeçalho
- 
-    if(!headerPage) { // caso nao consiga abrir
-        printf("Table '%s' doesn't exist\n", tableName);
-        return;
-    }
+    if(!headerPage)
+        return NULL;
 
-    // Carrega o a arvore
-    root = loadTableBPT(root, tableName);
+    schema = malloc(sizeof(tableSchema));
+    if(schema == NULL) {
+        perror("Table schema creation.");
+        exit(EXIT_FAILURE);
+    }
+    strcpy(schema->tableName, tableName);
+    schema->header = headerPage;
+    schema->pkFieldExist = schema->aiFieldExist = 0;
+    schema->pageFormat = 1;
+    attributes = schema->attributes;
 
 	// lê a quantidade de colunas da tabela
-  	fread(&qtdFields, sizeof(int), 1, headerPage);
-    if(debug) printf("Fileds count: %d\n", qtdFields);
+  	fread(&schema->qtdFields, sizeof(int), 1, headerPage);
+    if(debug) printf("Fileds count: %d\n", schema->qtdFields);
 
 	// laço para ler do cabeçalho da tabela: o nome, tamanho e tipo das colunas
-    for(int i = 0; i < qtdFields; i++) {
+    for(int i = 0; i < schema->qtdFields; i++) {
         fread(&attributes[i].type, 1, 1, headerPage);
         fread(&attributes[i].size, sizeof(int), 1, headerPage);
         fread(attributes[i].name, 15, 1, headerPage);
@@ -379,441 +738,2345 @@ void insertInto(char *sql, int numPage) {
         fread(&attributes[i].ai, sizeof(int), 1, headerPage);
 
         if(attributes[i].pk){
-            pkFieldExist = 1;
+            schema->pkFieldExist = 1;
             if(debug) printf("Table has primary key: %s\n", attributes[i].name);
 
             if(attributes[i].ai){
-                aiFieldExist = 1;
+                schema->aiFieldExist = 1;
                 if(debug) printf("Primary key %s is AI\n", attributes[i].name);
             }
         }
     }
 	
     // le o valor de auto increment
-    fread(&aiValue, sizeof(int), 1, headerPage);
-
-    // incrementa o controle do ai e atualiza o cabecalho
-    if(aiFieldExist){
-        aiValue++;
-        if(debug) printf("Next primary key value: %d\n", aiValue);
-        fseek(headerPage, -sizeof(int), SEEK_CUR);
-        fwrite(&aiValue, sizeof(int), 1, headerPage);
-    } else if(pkFieldExist == 1) {
-        if(debug) printf("Busca se chave já existe\n");
-        
-        memset(sqlExtractPK, '\0', sizeof(sqlExtractPK));
-        strcpy(sqlExtractPK, sql); 
-
-        pkInserted = extreactPkValueFromSQL(sqlExtractPK);
-        record * recordPk = find(root, pkInserted, false, NULL);
-
-        if(recordPk != NULL){
-            printf("Cannot duplicate a PK value\n");
-            return;
-        }
+    fread(&schema->aiValue, sizeof(int), 1, headerPage);
+    schema->countersPos = ftell(headerPage) - sizeof(int);
+
+    // le a quantidade de paginas e a ultima pagina, unica que ainda pode
+    // receber registros. Tabelas antigas nao tem a ultima pagina no
+    // cabecalho e as paginas sao percorridas uma unica vez para acha-la
+    fread(&schema->qtdPages, sizeof(int), 1, headerPage);
+    if(fread(&schema->lastPage, sizeof(int), 1, headerPage) != 1) {
+        schema->qtdPages = schema->lastPage = findLastPage(tableName);
+        saveTableSchema(schema);
+        schema->rowFormat = 1;
+    } else if(fread(&schema->rowFormat, sizeof(int), 1, headerPage) != 1) {
+        schema->rowFormat = 1; // tabela criada antes da versao do formato dos registros
+    } else if(fread(&schema->pageFormat, sizeof(int), 1, headerPage) != 1) {
+        schema->pageFormat = 1; // tabela criada antes da versao do formato das paginas
     }
-    
-  	// procura no arquivo o caminho da proxima pagina
-    fread(&nextPage, sizeof(int), 1, headerPage);
-    if(debug) printf("Next page value: %d\n", nextPage);
-  	fclose(headerPage); // fecha o cabeçalho
-    
-    strcpy(sqlCopy, sql); // faz uma cópia do script sql
-    token = strtok(sqlCopy, "()"); // procura os valores da inserção
-    token = strtok(NULL, "()"); // continua a busca de onde parou na chamada acima
+    buildRowLayout(&schema->layout, attributes, schema->qtdFields, schema->rowFormat);
+    if(debug) printf("Last page: %d of %d\n", schema->lastPage, schema->qtdPages);
 
-    memset(attrSql, '\0', sizeof(attrSql)); //limpa a variavel e seta o final dela
-    memset(attrSqlCopy, '\0', sizeof(attrSqlCopy)); // limpa a variável e seta o final dela
+    // Busca a arvore no cache (carrega do disco apenas no primeiro acesso)
+    schema->index = getTableIndex(tableName);
 
-    strcpy(attrSql, token); //copia o token de atributo para a variavel attrSql
+    schema->next = schemaCache;
+    schemaCache = schema;
 
-    strcpy(attrSqlCopy, attrSql); // faz uma copia da variavel attrSql
+    return schema;
+}
 
-    token = strtok(attrSqlCopy, ","); // quebra o token de atributos usando o delimitador de virgula
+/**
+ * Grava no header.dat o valor do ai, a quantidade de paginas e a ultima
+ * pagina. O header.dat fica aberto, o fflush deixa os valores visiveis para
+ * quem abre o arquivo e para o fsync do checkpoint
+ */
+void saveTableSchema(tableSchema *schema){
+    fseek(schema->header, schema->countersPos, SEEK_SET);
+    fwrite(&schema->aiValue, sizeof(int), 1, schema->header);
+    fwrite(&schema->qtdPages, sizeof(int), 1, schema->header);
+    fwrite(&schema->lastPage, sizeof(int), 1, schema->header);
+    fflush(schema->header);
+}
 
-   	// incrementa o tamanho do insert baseado no tipo dos atributos inseridos
-  	for(int i = 0; i < qtdFields; i++) {     	
-      	if(attributes[i].type == 'C') {
-            insertSize += attributes[i].size;
-        } else if(attributes[i].type == 'I') {
-            insertSize += attributes[i].size;
-        } else if(attributes[i].type == 'V') {
-            insertSize += strlen(token) + 1; // + 1 for special char of varchar '$'
-            //countVarchar
+/**
+ * Confere os valores de um insert com os campos da tabela: em cada linha um
+ * valor para cada campo menos o ai, e um numero nos campos int. Um
+ * parametro (?) ainda sem valor serve para qualquer campo. Retorna 0 se
+ * algum valor nao serve
+ */
+int checkInsertValues(tableSchema *schema, sql_statement *statement){
+    attribute *attributes = schema->attributes;
+    sql_token *values = statement->values;
+
+    if(statement->num_values != schema->qtdFields - schema->aiFieldExist) {
+        printf("Table '%s' expects %d values\n", schema->tableName, schema->qtdFields - schema->aiFieldExist);
+        return 0;
+    }
+    for(int r = 0; r < statement->num_rows; r++) {
+        for(int i = 0; i < schema->qtdFields; i++) {
+            if(attributes[i].pk && attributes[i].ai)
+                continue;
+            if(attributes[i].type == 'I' && values->type != TOKEN_NUMBER && values->type != TOKEN_PARAM) {
+                printf("Field %s expects an integer\n", attributes[i].name);
+                return 0;
+            }
+            values++;
         }
-        token = strtok(NULL, ",");
     }
 
-    strcpy(attrSqlCopy, attrSql); 
-
-    snprintf(pageName, sizeof(pageName), "%s/page%d.dat", tableName, numPage); //define o caminho da pagina com os registros da tabela
-    FILE * page = fopen(pageName, "rb+"); // abre a pagina como modo de leitura e escrita binaria
-
-    fread(&head.memFree, sizeof(int), 1, page); // quanto de espaço livre tem disponível naquela pagina
-    fread(&head.next, sizeof(int), 1, page); // caminho da proxima pagina
-    fread(&head.qtdItems, sizeof(int), 1, page); // quantidade de itens naquela pagina
-
-  	// se valores inseridos forem menores que o espaço livre na página, insere na mesma página
-    if(head.memFree > insertSize) {
-        token = strtok(attrSqlCopy, ",");
-        item newItem;
-        newItem.offset = head.next - insertSize;
-        newItem.totalLen = insertSize;
-        newItem.writed = 1;
-
-      	// calcula posição do próximo valor no cabeçalho da página 
-        nextItem = 12 + 12 * head.qtdItems;
-		// move ponteiro do arquivo para posição do próximo valor no cabeçalho da página
-        fseek(page, nextItem, SEEK_SET);
+    return 1;
+}
 
-		// insere informações do insert no cabeçalho da página
-      	fwrite(&newItem.offset, sizeof(int), 1, page);
-        fwrite(&newItem.totalLen, sizeof(int), 1, page);
-        fwrite(&newItem.writed, sizeof(int), 1, page);
-	
-		// move ponteiro para posição onde dados do
-        // insert serão inseridos na página
-        fseek(page, newItem.offset, SEEK_SET);
-
-        //printf("OFFSET NEW ITEM: %d\n", newItem.offset);
-
-      	// percorre os campos do insert
-        int pkValue = 0;
-        for(int i = 0; i < qtdFields; i++) {
-            if(attributes[i].pk && attributes[i].ai){
-                fwrite(&aiValue, attributes[i].size, 1, page);
-                pkValue = aiValue;
-
-            // char
-      		} else if(attributes[i].type == 'C') {
-                fwrite(token, strlen(token), 1, page);
-                qtdEndChar = attributes[i].size - strlen(token);
-                fwrite(&endChar, 1, qtdEndChar, page);
-
-            // int
-            } else if(attributes[i].type == 'I') {
-                intVar = atoi(token);
-                fwrite(&intVar, attributes[i].size, 1, page);
-                if(attributes[i].pk) {
-                    pkValue = intVar;
-                }
+int comparePkRow(const void *a, const void *b){
+    const pkRow *x = a, *y = b;
+    if(x->key != y->key)
+        return (x->key > y->key) - (x->key < y->key);
+    return (x->row > y->row) - (x->row < y->row);
+}
 
-            // varchar
-            } else if(attributes[i].type == 'V') {
-                fwrite(token, strlen(token), 1, page);
-                fwrite(&endVarchar, 1, 1, page);
-            }
-            
-            // pula a extração do valor quando possui ai
-            if((aiFieldExist && i > 0) || !aiFieldExist) {
-                token = strtok(NULL, ",");
-            }
-        }
+/**
+ * Marca em skip os registros cuja pk ja existe na tabela ou em um registro
+ * anterior, que sao descartados como no insert de um registro so. As chaves
+ * sao ordenadas (rows eh reordenado) e cada chave diferente eh buscada uma
+ * unica vez na arvore. Retorna a quantidade de registros descartados
+ */
+long markDuplicateRows(tableIndex *index, pkRow rows[], long qtdRows, char skip[]){
+    long qtdUnique = 0, qtdSkipped = 0;
+    int first;
+    int *keys = malloc((qtdRows > 0 ? qtdRows : 1) * sizeof(int));
+    record **found = malloc((qtdRows > 0 ? qtdRows : 1) * sizeof(record *));
+
+    if(keys == NULL || found == NULL) {
+        perror("Insert keys.");
+        exit(EXIT_FAILURE);
+    }
 
-        // adicione o id na B+
-        if(pkFieldExist){
-            root = insert(root, pkValue, numPage, newItem.offset);
-            if(debug) printf("Inserindo info da chave %d: pag->%d offset->%d\n", pkValue, numPage, newItem.offset);
-        }
-        
-        head.memFree = head.memFree - insertSize;
-        head.next = newItem.offset;
-        head.qtdItems += 1;
+    qsort(rows, qtdRows, sizeof(pkRow), comparePkRow);
 
-        fseek(page, 0, SEEK_SET);
+    // o filtro descarta sem descer na arvore as chaves que com certeza
+    // ainda nao existem, que sao quase todas
+    for(long r = 0; r < qtdRows; r++) {
+        if(r > 0 && rows[r].key == rows[r - 1].key)
+            continue;
+        if(index->filter == NULL || bloom_may_contain(index->filter, rows[r].key))
+            keys[qtdUnique++] = rows[r].key;
+    }
+    find_many(index->root, keys, qtdUnique, found);
+
+    // keys e found seguem a ordem de rows: o primeiro registro de cada chave
+    // que ainda nao existe eh inserido, os demais sao descartados
+    for(long r = 0, u = 0; r < qtdRows; r++) {
+        first = r == 0 || rows[r].key != rows[r - 1].key;
+        if(!first)
+            skip[rows[r].row] = 1;
+        else if(u < qtdUnique && keys[u] == rows[r].key)
+            skip[rows[r].row] = found[u++] != NULL;
+        else
+            skip[rows[r].row] = 0;
+        qtdSkipped += skip[rows[r].row];
+    }
 
-        fwrite(&head.memFree, sizeof(int), 1, page);
-        fwrite(&head.next, sizeof(int), 1, page);
-        fwrite(&head.qtdItems, sizeof(int), 1, page);
+    free(keys);
+    free(found);
+    return qtdSkipped;
+}
 
-        fclose(page);
+/**
+ * Marca em skip os registros de um insert com a pk repetida, como
+ * markDuplicateRows, com a mensagem de cada um
+ */
+int markDuplicateKeys(tableSchema *schema, sql_token values[], int qtdRows, char skip[]){
+    int qtdValues = schema->qtdFields - schema->aiFieldExist, qtdSkipped;
+    pkRow *rows = malloc(qtdRows * sizeof(pkRow));
 
-        // salva a arvore
-        saveTableBPT(root, tableName);
+    if(rows == NULL) {
+        perror("Insert keys.");
+        exit(EXIT_FAILURE);
+    }
 
-        printf("New item inserted\n");
-    } else {
-      	// cria uma nova pagina
-        fseek(page, 8191, SEEK_SET);
-        fread(&special, 1, 1, page);
-        //printf("Special: %c\n", special);
-        if(special == '0') {
-            //printf("Entrou special\n");
-            nextPage++;
-            //printf("Nome Pagina: %s\n", tableName);
-            //printf("Numero pagina: %d\n", nextPage);
-            //printf("SQL - %s\n", sql);
-            createPage(tableName, nextPage);
-            special = '1';
-            fseek(page, 8191, SEEK_SET);
-            fwrite(&special, 1, 1, page);
-            fclose(page);
-            insertInto(sql, nextPage);
-        } else {
-            fclose(page);
-            insertInto(sql, nextPage);
-        }
+    // a pk eh sempre o primeiro campo
+    for(int r = 0; r < qtdRows; r++) {
+        rows[r].key = (int)values[r * qtdValues].number;
+        rows[r].row = r;
     }
+    qtdSkipped = markDuplicateRows(schema->index, rows, qtdRows, skip);
+    for(int r = 0; r < qtdSkipped; r++)
+        printf("Cannot duplicate a PK value\n");
+
+    free(rows);
+    return qtdSkipped;
 }
 
 /**
- *	retorna o nome da tabela
+ * Tamanho do registro com os valores na pagina (o valor do ai nao vem no
+ * insert)
  */
-void getTableName(char *sql, char *name) {
-    char sqlCopy[1000];
-    char *token;
-    char keyParen[2] = "(";
-    char keySpace[2] = " ";
+int rowInsertSize(tableSchema *schema, sql_token values[]){
+    attribute *attributes = schema->attributes;
+    rowLayout *layout = &schema->layout;
+    int insertSize = 0;
 
-    memset(sqlCopy, '\0', sizeof(sqlCopy));
+   	// incrementa o tamanho do insert baseado no tipo dos atributos inseridos
+    // (no formato 2 os campos fixos e a tabela de offsets ocupam layout->varTable + 2 * qtdVar)
+    if(layout->format >= 2)
+        insertSize = layout->varTable + 2 * layout->qtdVar;
+    for(int i = 0; i < schema->qtdFields; i++) {
+        if(attributes[i].type == 'V') {
+            insertSize += values->text.len + (layout->format >= 2 ? 2 : 1); // tamanho ou '$'
+        } else if(layout->format < 2) {
+            insertSize += attributes[i].size;
+        }
 
-    strcpy(sqlCopy, sql);
+        // o valor do ai nao vem no insert
+        if(!(attributes[i].pk && attributes[i].ai))
+            values++;
+    }
 
-    token = strtok(sqlCopy, keyParen);
+    return insertSize;
+}
 
-    strcpy(sqlCopy, token);
+/**
+ * Grava o registro com os valores na pagina, onde ele precisa caber, e
+ * retorna o seu offset (ou slot). O valor da pk vai em *pkValue. Usa apenas
+ * a pagina e o esquema, os workers do copy gravam em paginas proprias
+ */
+int writeRow(tableSchema *schema, char *page, sql_token values[], int insertSize, int aiValue, int *pkValue){
+    char endVarchar = '$', endChar = '\0';
+    int intVar, qtdEndChar, pos, varPos, rowStart, pageFormat = schema->pageFormat;
+    unsigned short varLen, varOffset;
+    attribute *attributes = schema->attributes;
+    rowLayout *layout = &schema->layout;
+    sql_token *value = values; // valor do campo, direto da arvore do comando
+    item newItem;
+
+    // reserva o slot e o espaço do registro na página
+    newItem.offset = addPageRow(page, pageFormat, insertSize);
+
+    // na pagina comprimida o registro eh gravado inteiro no final da pagina
+    rowStart = newItem.offset;
+    if(pageFormat == PAGE_FORMAT_COMPRESSED)
+        rowStart = tailRowOffset(page, newItem.offset, insertSize);
+
+	// posição onde dados do insert serão inseridos na página
+    pos = rowStart;
+    varPos = rowStart + layout->varTable + 2 * layout->qtdVar;
+
+  	// percorre os campos do insert
+    *pkValue = 0;
+    for(int i = 0; i < schema->qtdFields; i++) {
+        // no formato 2 cada campo fixo tem posicao propria no registro
+        if(pageFormat == PAGE_FORMAT_PAX)
+            pos = paxField(page, layout, attributes, newItem.offset, i) - page;
+        else if(layout->format >= 2 && attributes[i].type != 'V')
+            pos = rowStart + layout->offset[i];
+
+        if(attributes[i].pk && attributes[i].ai){
+            memcpy(page + pos, &aiValue, attributes[i].size);
+            pos += attributes[i].size;
+            *pkValue = aiValue;
+
+        // char
+  		} else if(attributes[i].type == 'C') {
+            qtdEndChar = value->text.len < attributes[i].size ? value->text.len : attributes[i].size;
+            memcpy(page + pos, value->text.start, qtdEndChar);
+            memset(page + pos + qtdEndChar, endChar, attributes[i].size - qtdEndChar);
+            pos += attributes[i].size;
+
+        // int
+        } else if(attributes[i].type == 'I') {
+            intVar = (int)value->number;
+            memcpy(page + pos, &intVar, attributes[i].size);
+            pos += attributes[i].size;
+            if(attributes[i].pk) {
+                *pkValue = intVar;
+            }
 
-    token = strtok(sqlCopy, keySpace);
+        // varchar com tamanho, apontado pela tabela de offsets
+        } else if(attributes[i].type == 'V' && layout->format >= 2) {
+            varLen = value->text.len;
+            varOffset = varPos - rowStart;
+            memcpy(page + rowStart + layout->varTable + 2 * layout->offset[i], &varOffset, 2);
+            memcpy(page + varPos, &varLen, 2);
+            memcpy(page + varPos + 2, value->text.start, varLen);
+            varPos += 2 + varLen;
 
-    while(token != NULL) {
-        strcpy(name, token);
-        token = strtok(NULL, keySpace);
+        // varchar terminado por '$'
+        } else if(attributes[i].type == 'V') {
+            memcpy(page + pos, value->text.start, value->text.len);
+            pos += value->text.len;
+            page[pos++] = endVarchar;
+        }
+        
+        // o valor do ai nao vem no insert
+        if(!(attributes[i].pk && attributes[i].ai))
+            value++;
     }
+
+    return newItem.offset;
 }
 
 /**
- * lê cabeçalho da primeira página da tabela
+ * Retorna o esquema da tabela do comando, ou NULL (com a mensagem de erro)
+ * se a tabela nao existe
  */
-void leArquivo(char *tableName) {
-    char pageName[600];
-    char pageCoisa[600];
+tableSchema *statementSchema(sql_statement *statement){
+    char tableName[500];
+    tableSchema *schema;
 
-    snprintf(pageCoisa, sizeof(pageCoisa), "%s/page1.dat", tableName); //define o caminho da pagina de determinada tabela
-
-    FILE *page = fopen(pageCoisa, "rb+"); // abre a pagina da tabela como leitura e escrita binária
-
-    header head; 
+    if(!sql_view_copy(statement->table, tableName, sizeof(tableName))) {
+        printf("Table name is too long\n");
+        return NULL;
+    }
 
-    fread(&head.memFree, sizeof(int), 1, page);
-    fread(&head.next, sizeof(int), 1, page);
-    fread(&head.qtdItems, sizeof(int), 1, page);
-    //printf("MemFree - %d; Next - %d - QtdItems - %d\n", head.memFree, head.next, head.qtdItems);
+    schema = getTableSchema(tableName);
+    if(schema == NULL)
+        printf("Table '%s' doesn't exist\n", tableName);
 
-    fclose(page); // fecha a página
+    return schema;
 }
 
-void saveTableBPT(node * const root, char *tableName){
-    // print_leaves(root);
-    char pkFile[600];
-    int idCount = 0, i;
-    node *c = root;
-    record *data = NULL;
+void insertInto(sql_statement *statement) { 
+    tableSchema *schema = statementSchema(statement);
 
-    snprintf(pkFile, sizeof(pkFile), "%s/pk.dat", tableName); 
-    FILE *fp = fopen(pkFile, "wb"); 
+    // os valores sao conferidos antes de qualquer alteracao na tabela
+    if(schema != NULL && checkInsertValues(schema, statement))
+        insertRows(schema, statement->values, statement->num_rows);
+}
 
-    if(fp == NULL){
-        return;
+/**
+ * Grava os registros de um insert, com os valores ja conferidos por
+ * checkInsertValues (o valor do ai nao vem no insert). Os registros
+ * preenchem as paginas em sequencia, com um registro do wal.log por pagina
+ * e um unico wal_commit, e as chaves entram no indice de uma vez no final
+ */
+void insertRows(tableSchema *schema, sql_token values[], int qtdRows) {
+    int insertSize, pkValue, offset;
+    int qtdKeys = 0, pageKeys = 0, qtdInserted = 0;
+    char *tableName = schema->tableName;
+    int pageFormat = schema->pageFormat, numPage = schema->lastPage;
+    int qtdValues = schema->qtdFields - schema->aiFieldExist;
+    tableIndex *index = schema->index;
+    char before[PAGE_SIZE]; // pagina antes do insert, para o wal.log
+    char empty[PAGE_SIZE]; // pagina vazia do formato da tabela
+    walChange change;
+    walInsert walHead;
+    sql_token *value; // valores do registro, direto da arvore do comando
+    entry *keys; // chaves inseridas, que vao para o indice
+    char *skip; // registros descartados pela pk repetida
+    long lsn;
+
+    keys = malloc(qtdRows * sizeof(entry));
+    skip = calloc(qtdRows, 1);
+    if(keys == NULL || skip == NULL) {
+        perror("Insert rows.");
+        exit(EXIT_FAILURE);
     }
-    fwrite(&idCount, sizeof(int), 1, fp);
 
-    if(root != NULL){
-        while (!c->is_leaf)
-            c = c->pointers[0];
-
-        while (true){
-            for (i = 0; i < c->num_keys; i++){
-                data = (record *)c->pointers[i];
-                if(debug) printf("Inserindo no arquivo da B+ key(%d) page(%d) offset(%d)\n", c->keys[i], data->page, data->offset);
-                fwrite(&c->keys[i], sizeof(int), 1, fp);
-                fwrite(&data->page, sizeof(int), 1, fp);
-                fwrite(&data->offset, sizeof(int), 1, fp);
-                idCount++;
-            }
-            if (c->pointers[DEFAULT_ORDER - 1] != NULL) {
-            }
-            else
-                break;
+    if(schema->pkFieldExist && !schema->aiFieldExist) {
+        if(debug) printf("Busca se chave já existe\n");
+        if(markDuplicateKeys(schema, values, qtdRows, skip) == qtdRows) {
+            if(qtdRows > 1)
+                printf("0 items inserted\n");
+            free(keys);
+            free(skip);
+            return;
         }
     }
 
-    fseek(fp, 0, SEEK_SET);
-    fwrite(&idCount, sizeof(int), 1, fp);
-    fclose(fp);
+    char *page = pin_page(tableName, numPage); // pagina da tabela no buffer pool
+    memcpy(before, page, PAGE_SIZE);
+    walBegin(&change, tableName);
+    initPage(empty, pageFormat);
 
-    destroy_tree(root);
-}
+    for(int r = 0; r < qtdRows; r++) {
+        if(skip[r])
+            continue;
 
-node *loadTableBPT(node *root, char *tableName){
-    char pkDataFIle[600];
-    int key, page, offset, idCount, i;
+        value = values + r * qtdValues;
+        insertSize = rowInsertSize(schema, value);
+
+        // registro maior que uma pagina vazia, recusado antes de gastar um
+        // valor do ai ou de criar uma pagina
+        if(!pageFits(empty, pageFormat, insertSize)) {
+            printf("Row is too large for a page\n");
+            continue;
+        }
 
-    snprintf(pkDataFIle, sizeof(pkDataFIle), "%s/pk.dat", tableName); //define o caminho da pagina de determinada tabela
+        // incrementa o controle do ai, gravado no cabecalho apos o wal.log
+        if(schema->aiFieldExist){
+            schema->aiValue++;
+            if(debug) printf("Next primary key value: %d\n", schema->aiValue);
+        }
 
-    FILE *fp = fopen(pkDataFIle, "r"); // abre a pagina da tabela como leitura e escrita binária
+        // na pagina comprimida, os registros ainda nao codificados sao
+        // codificados antes de se criar uma nova pagina
+        if(pageFormat == PAGE_FORMAT_COMPRESSED && !pageFits(page, pageFormat, insertSize))
+            compressPage(page, schema->attributes, schema->qtdFields, &schema->layout);
+
+      	// se valores inseridos nao couberem no espaço livre da última página (com o seu
+        // slot), cria uma nova página e a encadeia na última. O registro do
+        // wal.log da pagina cheia leva tambem a nova pagina vazia
+        if(!pageFits(page, pageFormat, insertSize)) {
+            int fullPageNo = numPage;
+
+            page[8191] = '1';
+            walPageChange(&change, before, page, numPage);
+
+            numPage = ++schema->qtdPages;
+            schema->lastPage = numPage;
+            createPage(tableName, numPage, pageFormat);
+            if(debug) printf("New page: %d\n", numPage);
+
+            page = pin_page(tableName, numPage);
+            memset(before, 0, PAGE_SIZE);
+            walPageChange(&change, before, page, numPage);
+
+            // a pagina cheia so pode ir para o disco apos o seu registro
+            walHead.aiValue = schema->aiValue;
+            walHead.qtdPages = schema->qtdPages;
+            walHead.lastPage = numPage;
+            walEnd(&change, &walHead, keys + qtdKeys - pageKeys, pageKeys);
+            unpin_page(tableName, fullPageNo, true);
+            pageKeys = 0;
+
+            memcpy(before, page, PAGE_SIZE);
+            walBegin(&change, tableName);
+        }
 
-    if(fp != NULL){
-        // Le a quantidade de registros
-        fread(&idCount, sizeof(int), 1, fp);
+        offset = writeRow(schema, page, value, insertSize, schema->aiValue, &pkValue);
 
-        if(idCount > 0){
-            for (i = 0; i < idCount; i++) {
-                fread(&key, sizeof(int), 1, fp);
-                fread(&page, sizeof(int), 1, fp);
-                fread(&offset, sizeof(int), 1, fp);
-                root = insert(root, key, page, offset);
-            }
+        if(schema->pkFieldExist) {
+            keys[qtdKeys].key = pkValue;
+            keys[qtdKeys].value.page = numPage;
+            keys[qtdKeys].value.offset = offset;
+            qtdKeys++;
+            pageKeys++;
         }
-        if(debug) printf("Pk da tabela %s foi carregada com sucesso\n", tableName);
-    } else {
-        if(debug) printf("Pk da tabela %s não existe\n", tableName);
+        qtdInserted++;
     }
 
-    fclose(fp);
+    // os registros do wal.log tem que ser duraveis antes do cabecalho ser
+    // gravado (com a nova ultima pagina) e das chaves irem para o indice
+    walPageChange(&change, before, page, numPage);
+    walHead.aiValue = schema->aiValue;
+    walHead.qtdPages = schema->qtdPages;
+    walHead.lastPage = numPage;
+    lsn = walEnd(&change, &walHead, keys + qtdKeys - pageKeys, pageKeys);
+    wal_commit(lsn);
+    saveTableSchema(schema);
+    addChangedTable(tableName);
+    unpin_page(tableName, numPage, qtdInserted > 0);
+
+    // adicione os ids na B+ de uma vez, com o ai sempre na folha mais a
+    // direita. As chaves ja estao no wal.log, que as refaz se o pk.dat nao
+    // chegar a ser gravado
+    if(qtdKeys > 0) {
+        beginTableChange(index);
+        if(schema->aiFieldExist) {
+            for(int k = 0; k < qtdKeys; k++)
+                index->root = insert_sequential(index->root, index->meta.order, &index->lastLeaf,
+                    keys[k].key, keys[k].value.page, keys[k].value.offset);
+        } else
+            index->root = insert_batch(index->root, index->meta.order, keys, qtdKeys);
+        endTableChange(index);
+        index->meta.qtdKeys += qtdKeys;
 
-    return root;
+        if(index->filter != NULL)
+            addTableBloomKeys(index, keys, qtdKeys);
+        if(debug) printf("%d chaves inseridas na B+\n", qtdKeys);
+    }
+
+    if(qtdRows == 1 && qtdInserted == 1)
+        printf("New item inserted\n");
+    else if(qtdRows > 1)
+        printf("%d items inserted\n", qtdInserted);
+
+    free(keys);
+    free(skip);
+}
+
+/**
+ * Comando "prepare <nome> as <comando>": o comando eh lido e conferido uma
+ * unica vez e guardado com o esquema da tabela. Um comando com o mesmo nome
+ * eh substituido
+ */
+void prepareStatement(sql_statement *statement) {
+    char name[100], error[200];
+    preparedStatement *prepared, **link;
+    sql_statement *body;
+    int valid;
+
+    if(!sql_view_copy(statement->name, name, sizeof(name))) {
+        printf("Statement name is too long\n");
+        return;
+    }
+
+    // as views da arvore apontam para o texto, que fica guardado com ela
+    prepared = malloc(sizeof(preparedStatement));
+    if(prepared == NULL) {
+        perror("Prepared statement creation.");
+        exit(EXIT_FAILURE);
+    }
+    prepared->text = malloc(statement->body.len + 1);
+    if(prepared->text == NULL) {
+        perror("Prepared statement creation.");
+        exit(EXIT_FAILURE);
+    }
+    sql_view_copy(statement->body, prepared->text, statement->body.len + 1);
+    strcpy(prepared->name, name);
+    prepared->schema = NULL;
+    body = &prepared->statement;
+
+    valid = sql_parse(prepared->text, body, error, sizeof(error));
+    if(!valid)
+        printf("%s\n", error);
+    if(valid && body->type != STATEMENT_INSERT && body->type != STATEMENT_SELECT) {
+        printf("Only insert and select can be prepared\n");
+        valid = 0;
+    }
+    if(valid) {
+        prepared->schema = statementSchema(body);
+        valid = prepared->schema != NULL;
+    }
+    if(valid && body->type == STATEMENT_INSERT)
+        valid = checkInsertValues(prepared->schema, body);
+    if(valid && body->type == STATEMENT_SELECT && body->where.len > 0)
+        valid = checkSelectKey(prepared->schema, body);
+    if(!valid) {
+        sql_free(body);
+        free(prepared->text);
+        free(prepared);
+        return;
+    }
+
+    for(link = &preparedStatements; *link != NULL; link = &(*link)->next) {
+        if(strcmp((*link)->name, name) == 0) {
+            preparedStatement *old = *link;
+            *link = old->next;
+            sql_free(&old->statement);
+            free(old->text);
+            free(old);
+            break;
+        }
+    }
+    prepared->next = preparedStatements;
+    preparedStatements = prepared;
+
+    printf("Prepared statement %s\n", name);
+}
+
+/**
+ * Comando "execute <nome> (<valores>)": os valores entram no lugar dos
+ * parametros (?) do comando preparado, em ordem, sem ler o comando nem o
+ * cabecalho da tabela de novo
+ */
+void executeStatement(sql_statement *statement) {
+    char name[100];
+    preparedStatement *prepared;
+    sql_statement *body;
+
+    if(!sql_view_copy(statement->name, name, sizeof(name))) {
+        printf("Statement name is too long\n");
+        return;
+    }
+
+    for(prepared = preparedStatements; prepared != NULL; prepared = prepared->next) {
+        if(strcmp(prepared->name, name) == 0)
+            break;
+    }
+    if(prepared == NULL) {
+        printf("Prepared statement '%s' doesn't exist\n", name);
+        return;
+    }
+
+    body = &prepared->statement;
+    if(statement->num_values != body->num_params) {
+        printf("Statement %s expects %d parameters\n", name, body->num_params);
+        return;
+    }
+
+    // os valores apontam para o texto do execute, que vale ate o fim dele
+    for(int k = 0; k < body->num_params; k++)
+        body->values[body->params[k]] = statement->values[k];
+
+    if(body->type == STATEMENT_SELECT) {
+        selectRows(prepared->schema, body);
+        return;
+    }
+
+    if(checkInsertValues(prepared->schema, body))
+        insertRows(prepared->schema, body->values, body->num_rows);
+}
+
+/**
+ * Fase 1 do copy, em um worker: le as linhas do trecho, confere os valores
+ * e guarda as pks (tabela com pk sem ai), para achar as repetidas antes de
+ * gravar qualquer pagina
+ */
+void *copyScanChunk(void *arg){
+    copyChunk *chunk = arg;
+    tableSchema *schema = chunk->schema;
+    attribute *attributes = schema->attributes;
+    int qtdValues = schema->qtdFields - schema->aiFieldExist, qtdRead;
+    int keepKeys = schema->pkFieldExist && !schema->aiFieldExist;
+    const char *pos = chunk->start;
+    sql_token values[SQL_MAX_COLUMNS];
+    int keysCapacity = 0;
+    char empty[PAGE_SIZE];
+
+    initPage(empty, schema->pageFormat);
+
+    while(pos < chunk->end) {
+        chunk->qtdLines++;
+        qtdRead = sql_csv_line(&pos, chunk->end, values, SQL_MAX_COLUMNS);
+        if(qtdRead == 0)
+            continue;
+
+        if(qtdRead != qtdValues) {
+            snprintf(chunk->error, sizeof(chunk->error), "expected %d values", qtdValues);
+            return NULL;
+        }
+        for(int i = 0, v = 0; i < schema->qtdFields; i++) {
+            if(attributes[i].pk && attributes[i].ai)
+                continue;
+            if(attributes[i].type == 'I' && values[v].type != TOKEN_NUMBER) {
+                snprintf(chunk->error, sizeof(chunk->error), "field %s expects an integer", attributes[i].name);
+                return NULL;
+            }
+            v++;
+        }
+
+        // a pk eh sempre o primeiro campo. A posicao do registro no arquivo
+        // so eh conhecida quando todos os trechos foram lidos
+        if(keepKeys) {
+            if(chunk->qtdRows == keysCapacity) {
+                keysCapacity = keysCapacity > 0 ? 2 * keysCapacity : 1024;
+                chunk->rows = realloc(chunk->rows, keysCapacity * sizeof(pkRow));
+                if(chunk->rows == NULL) {
+                    perror("Copy keys.");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            chunk->rows[chunk->qtdRows].key = (int)values[0].number;
+            chunk->rows[chunk->qtdRows].row = chunk->qtdRows;
+        }
+
+        // o registro maior que uma pagina vazia nao consome um valor do ai,
+        // e os trechos seguintes numeram os seus a partir desta contagem
+        if(schema->aiFieldExist && pageFits(empty, schema->pageFormat, rowInsertSize(schema, values)))
+            chunk->qtdAiRows++;
+        chunk->qtdRows++;
+    }
+
+    return NULL;
+}
+
+/**
+ * Acrescenta uma pagina vazia as paginas do trecho
+ */
+char *copyNewPage(copyChunk *chunk){
+    if(chunk->qtdPages == chunk->pagesCapacity) {
+        chunk->pagesCapacity = chunk->pagesCapacity > 0 ? 2 * chunk->pagesCapacity : 64;
+        chunk->pages = realloc(chunk->pages, chunk->pagesCapacity * sizeof(char *));
+        if(chunk->pages == NULL) {
+            perror("Copy pages.");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    char *page = malloc(PAGE_SIZE);
+    if(page == NULL) {
+        perror("Copy pages.");
+        exit(EXIT_FAILURE);
+    }
+    memset(page, 0, PAGE_SIZE);
+    initPage(page, chunk->schema->pageFormat);
+    page[8191] = '1'; // as paginas do copy sao encadeadas, a ultima eh corrigida no final
+    chunk->pages[chunk->qtdPages++] = page;
+    return page;
+}
+
+/**
+ * Fase 2 do copy, em um worker: grava os registros do trecho, menos os de pk
+ * repetida, em paginas proprias do trecho, como o insert faria. As chaves
+ * guardam o indice da pagina no trecho, trocado pelo numero da pagina
+ * quando as paginas vao para a tabela
+ */
+void *copyEncodeChunk(void *arg){
+    copyChunk *chunk = arg;
+    tableSchema *schema = chunk->schema;
+    int pageFormat = schema->pageFormat, insertSize, pkValue, offset;
+    const char *pos = chunk->start;
+    sql_token values[SQL_MAX_COLUMNS];
+    long row = chunk->firstRow;
+    char *page = copyNewPage(chunk);
+
+    if(schema->pkFieldExist) {
+        chunk->keys = malloc((chunk->qtdRows > 0 ? chunk->qtdRows : 1) * sizeof(entry));
+        if(chunk->keys == NULL) {
+            perror("Copy keys.");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    while(pos < chunk->end) {
+        if(sql_csv_line(&pos, chunk->end, values, SQL_MAX_COLUMNS) == 0)
+            continue;
+        if(chunk->skip != NULL && chunk->skip[row]) {
+            row++;
+            continue;
+        }
+
+        insertSize = rowInsertSize(schema, values);
+        if(pageFormat == PAGE_FORMAT_COMPRESSED && !pageFits(page, pageFormat, insertSize))
+            compressPage(page, schema->attributes, schema->qtdFields, &schema->layout);
+        if(!pageFits(page, pageFormat, insertSize) && pageRowCount(page, pageFormat) > 0)
+            page = copyNewPage(chunk);
+
+        // o ai segue a ordem do arquivo e, como no insert, nao eh consumido
+        // pelo registro maior que uma pagina vazia. Na tabela com ai nenhum
+        // registro eh descartado pela pk, e os gravados sao numerados em
+        // sequencia
+        if(!pageFits(page, pageFormat, insertSize)) {
+            chunk->qtdTooLarge++;
+            row++;
+            continue;
+        }
+        offset = writeRow(schema, page, values, insertSize, chunk->aiBase + (int)chunk->qtdInserted + 1, &pkValue);
+        row++;
+
+        if(schema->pkFieldExist) {
+            chunk->keys[chunk->qtdKeys].key = pkValue;
+            chunk->keys[chunk->qtdKeys].value.page = chunk->qtdPages - 1;
+            chunk->keys[chunk->qtdKeys].value.offset = offset;
+            chunk->qtdKeys++;
+        }
+        chunk->qtdInserted++;
+    }
+
+    // o trecho sem registros nao deixa pagina vazia na tabela
+    if(pageRowCount(page, pageFormat) == 0)
+        free(chunk->pages[--chunk->qtdPages]);
+
+    return NULL;
+}
+
+/**
+ * Roda o trabalho em um thread por trecho
+ */
+void runCopyWorkers(copyChunk chunks[], int qtdChunks, void *(*work)(void *)){
+    pthread_t threads[COPY_MAX_THREADS];
+
+    for(int c = 0; c < qtdChunks; c++) {
+        if(pthread_create(&threads[c], NULL, work, &chunks[c]) != 0) {
+            perror("Copy worker.");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for(int c = 0; c < qtdChunks; c++)
+        pthread_join(threads[c], NULL);
+}
+
+int compareEntry(const void *a, const void *b){
+    const entry *x = a, *y = b;
+    return (x->key > y->key) - (x->key < y->key);
+}
+
+/**
+ * Grava os registros do copy, ja conferidos pela fase 1: acha as pks
+ * repetidas, roda a fase 2 em levas de trechos e coloca as paginas e as
+ * chaves na tabela
+ */
+void copyRows(tableSchema *schema, copyChunk chunks[], int qtdChunks, int qtdThreads, long qtdRows){
+    tableIndex *index = schema->index;
+    long qtdSkipped = 0, qtdInserted = 0, qtdTooLarge = 0, qtdKeys = 0;
+    int oldLastPage = schema->lastPage, firstNewPage = schema->qtdPages + 1;
+    char *skip = NULL, *page;
+    entry *keys = NULL;
+    walChange change;
+    walInsert walHead;
+    char before[PAGE_SIZE];
+
+    // as pks de todos os trechos, com a posicao do registro no arquivo
+    if(schema->pkFieldExist && !schema->aiFieldExist) {
+        pkRow *rows = malloc(qtdRows * sizeof(pkRow));
+        skip = malloc(qtdRows);
+        if(rows == NULL || skip == NULL) {
+            perror("Copy keys.");
+            exit(EXIT_FAILURE);
+        }
+        for(int c = 0; c < qtdChunks; c++) {
+            for(long r = 0; r < chunks[c].qtdRows; r++) {
+                rows[chunks[c].firstRow + r].key = chunks[c].rows[r].key;
+                rows[chunks[c].firstRow + r].row = chunks[c].firstRow + r;
+            }
+            chunks[c].skip = skip;
+        }
+        qtdSkipped = markDuplicateRows(index, rows, qtdRows, skip);
+        free(rows);
+    }
+
+    if(schema->pkFieldExist) {
+        keys = malloc(qtdRows * sizeof(entry));
+        if(keys == NULL) {
+            perror("Copy keys.");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // fase 2: cada leva de trechos eh gravada em paginas proprias, que vao
+    // para o buffer pool na ordem do arquivo
+    for(int c = 0; c < qtdChunks; c += qtdThreads) {
+        int qtdWave = qtdChunks - c < qtdThreads ? qtdChunks - c : qtdThreads;
+        runCopyWorkers(chunks + c, qtdWave, copyEncodeChunk);
+
+        for(int w = c; w < c + qtdWave; w++) {
+            int firstPage = schema->qtdPages + 1;
+
+            for(int p = 0; p < chunks[w].qtdPages; p++) {
+                page = pin_new_page(schema->tableName, ++schema->qtdPages);
+                memcpy(page, chunks[w].pages[p], PAGE_SIZE);
+                unpin_page(schema->tableName, schema->qtdPages, true);
+                free(chunks[w].pages[p]);
+            }
+            for(long k = 0; k < chunks[w].qtdKeys; k++) {
+                keys[qtdKeys] = chunks[w].keys[k];
+                keys[qtdKeys++].value.page += firstPage;
+            }
+            qtdInserted += chunks[w].qtdInserted;
+            qtdTooLarge += chunks[w].qtdTooLarge;
+            free(chunks[w].pages);
+            free(chunks[w].keys);
+            chunks[w].pages = NULL;
+            chunks[w].keys = NULL;
+        }
+    }
+
+    if(schema->aiFieldExist)
+        schema->aiValue += qtdInserted;
+
+    // as paginas novas ficam no disco antes de qualquer referencia a elas.
+    // A ultima pagina nova fecha a tabela
+    if(schema->qtdPages >= firstNewPage) {
+        page = pin_page(schema->tableName, schema->qtdPages);
+        page[8191] = '0';
+        unpin_page(schema->tableName, schema->qtdPages, true);
+        sync_pages();
+        schema->lastPage = schema->qtdPages;
+    }
+
+    // um unico registro do wal.log encadeia as paginas novas na tabela e
+    // leva o cabecalho e as chaves
+    page = pin_page(schema->tableName, oldLastPage);
+    memcpy(before, page, PAGE_SIZE);
+    if(schema->qtdPages >= firstNewPage)
+        page[8191] = '1';
+    walBegin(&change, schema->tableName);
+    walPageChange(&change, before, page, oldLastPage);
+    walHead.aiValue = schema->aiValue;
+    walHead.qtdPages = schema->qtdPages;
+    walHead.lastPage = schema->lastPage;
+    wal_commit(walEnd(&change, &walHead, keys, qtdKeys));
+    unpin_page(schema->tableName, oldLastPage, schema->qtdPages >= firstNewPage);
+    saveTableSchema(schema);
+    addChangedTable(schema->tableName);
+
+    // a arvore vazia eh montada de baixo para cima, com as chaves ordenadas
+    if(qtdKeys > 0) {
+        if(!schema->aiFieldExist)
+            qsort(keys, qtdKeys, sizeof(entry), compareEntry);
+
+        beginTableChange(index);
+        if(index->root == NULL) {
+            bulk_loader loader;
+            bulk_load_start(&loader, index->meta.order, PK_FILL_FACTOR);
+            for(long k = 0; k < qtdKeys; k++)
+                bulk_load_add(&loader, keys[k].key, keys[k].value.page, keys[k].value.offset);
+            index->root = bulk_load_finish(&loader);
+        } else
+            index->root = insert_batch(index->root, index->meta.order, keys, qtdKeys);
+        index->lastLeaf = NULL;
+        endTableChange(index);
+        index->meta.qtdKeys += qtdKeys;
+
+        if(index->filter != NULL)
+            addTableBloomKeys(index, keys, qtdKeys);
+    }
+
+    printf("%ld rows copied", qtdInserted);
+    if(qtdSkipped > 0)
+        printf(", %ld duplicate PK values skipped", qtdSkipped);
+    if(qtdTooLarge > 0)
+        printf(", %ld rows too large for a page", qtdTooLarge);
+    printf("\n");
+
+    free(skip);
+    free(keys);
+}
+
+/**
+ * Comando "copy <tabela> from '<arquivo.csv>'": carrega um registro por
+ * linha do arquivo, com os campos separados por virgula. O arquivo eh
+ * dividido em trechos de COPY_CHUNK_BYTES lidos por workers, em levas de
+ * ate COPY_MAX_THREADS: a fase 1 confere as linhas (uma linha invalida
+ * cancela o copy antes de qualquer alteracao) e a fase 2 grava os registros
+ * direto em paginas novas. As pks repetidas e o ai seguem o insert
+ */
+void copyFrom(sql_statement *statement){
+    char fileName[600], *data = NULL;
+    tableSchema *schema = statementSchema(statement);
+    copyChunk *chunks = NULL;
+    int qtdChunks = 0, qtdThreads, fd, lastLine = 0, valid = 1, aiValue;
+    long qtdRows = 0;
+    struct stat fileStat;
+
+    if(schema == NULL)
+        return;
+    aiValue = schema->aiValue; // valor do ai antes do primeiro registro de cada trecho
+    if(!sql_view_copy(statement->file, fileName, sizeof(fileName))) {
+        printf("File name is too long\n");
+        return;
+    }
+
+    fd = open(fileName, O_RDONLY);
+    if(fd < 0 || fstat(fd, &fileStat) != 0) {
+        printf("Cannot open file '%s'\n", fileName);
+        if(fd >= 0)
+            close(fd);
+        return;
+    }
+    if(fileStat.st_size > 0) {
+        data = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data == MAP_FAILED) {
+            printf("Cannot read file '%s'\n", fileName);
+            close(fd);
+            return;
+        }
+    }
+    close(fd);
+
+    // trechos terminados no fim de uma linha
+    for(const char *start = data; start < data + fileStat.st_size; ) {
+        const char *end = start + COPY_CHUNK_BYTES;
+        if(end >= data + fileStat.st_size)
+            end = data + fileStat.st_size;
+        else {
+            end = memchr(end, '\n', data + fileStat.st_size - end);
+            end = end != NULL ? end + 1 : data + fileStat.st_size;
+        }
+
+        chunks = realloc(chunks, (qtdChunks + 1) * sizeof(copyChunk));
+        if(chunks == NULL) {
+            perror("Copy chunks.");
+            exit(EXIT_FAILURE);
+        }
+        memset(&chunks[qtdChunks], 0, sizeof(copyChunk));
+        chunks[qtdChunks].schema = schema;
+        chunks[qtdChunks].start = start;
+        chunks[qtdChunks].end = end;
+        qtdChunks++;
+        start = end;
+    }
+
+    qtdThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(qtdThreads < 1)
+        qtdThreads = 1;
+    if(qtdThreads > COPY_MAX_THREADS)
+        qtdThreads = COPY_MAX_THREADS;
+
+    // fase 1: confere as linhas e conta os registros de cada trecho
+    for(int c = 0; c < qtdChunks; c += qtdThreads)
+        runCopyWorkers(chunks + c, qtdChunks - c < qtdThreads ? qtdChunks - c : qtdThreads, copyScanChunk);
+
+    for(int c = 0; c < qtdChunks && valid; c++) {
+        if(chunks[c].error[0] != '\0') {
+            printf("Line %d: %s\n", lastLine + chunks[c].qtdLines, chunks[c].error);
+            valid = 0;
+        }
+        lastLine += chunks[c].qtdLines;
+        chunks[c].firstRow = qtdRows;
+        qtdRows += chunks[c].qtdRows;
+        chunks[c].aiBase = aiValue;
+        aiValue += chunks[c].qtdAiRows;
+    }
+
+    if(valid && qtdRows == 0)
+        printf("0 rows copied\n");
+    else if(valid)
+        copyRows(schema, chunks, qtdChunks, qtdThreads, qtdRows);
+
+    for(int c = 0; c < qtdChunks; c++)
+        free(chunks[c].rows);
+    free(chunks);
+    if(data != NULL)
+        munmap(data, fileStat.st_size);
+}
+
+/**
+ * lê cabeçalho da primeira página da tabela
+ */
+void leArquivo(char *tableName) {
+    char *page = pin_page(tableName, 1); // primeira pagina da tabela no buffer pool
+
+    header head; 
+
+    memcpy(&head.memFree, page, sizeof(int));
+    memcpy(&head.next, page + 4, sizeof(int));
+    memcpy(&head.qtdItems, page + 8, sizeof(int));
+    //printf("MemFree - %d; Next - %d - QtdItems - %d\n", head.memFree, head.next, head.qtdItems);
+
+    unpin_page(tableName, 1, false); // libera a página
+}
+
+/**
+ * Grava um no da arvore na sua pagina do pk.dat.
+ * Layout: isLeaf, numKeys, 0 (antes a proxima folha), chaves[order - 1] e
+ * em seguida (page, offset) das folhas ou as paginas dos filhos
+ */
+void writeBPTPage(FILE *fp, node *n){
+    int buf[PAGE_SIZE / sizeof(int)];
+    int *keys = buf + 3, *pointers = buf + 3 + (n->order - 1);
+    record *data;
+
+    memset(buf, 0, sizeof(buf));
+    buf[0] = n->is_leaf;
+    buf[1] = n->num_keys;
+
+    for(int i = 0; i < n->num_keys; i++)
+        keys[i] = n->keys[i];
+
+    if(n->is_leaf) {
+        for(int i = 0; i < n->num_keys; i++) {
+            data = &n->records[i];
+            pointers[2 * i] = data->page;
+            pointers[2 * i + 1] = data->offset;
+        }
+    } else {
+        for(int i = 0; i <= n->num_keys; i++)
+            pointers[i] = UNLOADED(n->pointers[i]) ? UNLOADED_PAGE(n->pointers[i]) : n->pointers[i]->disk_page;
+    }
+
+    fseek(fp, (long)n->disk_page * PAGE_SIZE, SEEK_SET);
+    fwrite(buf, PAGE_SIZE, 1, fp);
+}
+
+/**
+ * Le o no gravado na pagina pageNo do pk.dat. Os filhos de um no interno
+ * ficam apenas com a sua pagina e sao lidos quando visitados. Retorna NULL
+ * se a pagina nao pode ser lida inteira ou nao eh um no valido (pk.dat
+ * cortado ou corrompido)
+ */
+node *readBPTPage(tableIndex *index, int pageNo){
+    int buf[PAGE_SIZE / sizeof(int)];
+    int order = index->meta.order;
+    int *keys = buf + 3, *pointers = buf + 3 + (order - 1);
+    node *n;
+
+    if(pageNo <= 0 || pageNo >= index->meta.qtdPages)
+        return NULL;
+    if(pread(index->fd, buf, PAGE_SIZE, (off_t)pageNo * PAGE_SIZE) != PAGE_SIZE)
+        return NULL;
+    if(buf[1] < 0 || buf[1] > order - 1 || (!buf[0] && buf[1] == 0))
+        return NULL;
+
+    // um no aponta apenas para paginas do arquivo
+    for(int i = 0; !buf[0] && i <= buf[1]; i++) {
+        if(pointers[i] <= 0 || pointers[i] >= index->meta.qtdPages || pointers[i] == pageNo)
+            return NULL;
+    }
+
+    n = buf[0] ? make_leaf(order) : make_node(order);
+    n->disk_page = pageNo;
+    n->num_keys = buf[1];
+
+    // o no lido nao tem o que regravar: make_node o pos no inicio da lista
+    // dos alterados
+    dirty_nodes = n->next_dirty;
+    n->dirty = false;
+    n->next_dirty = NULL;
+
+    for(int i = 0; i < n->num_keys; i++)
+        n->keys[i] = keys[i];
+
+    if(n->is_leaf) {
+        for(int i = 0; i < n->num_keys; i++) {
+            n->records[i].page = pointers[2 * i];
+            n->records[i].offset = pointers[2 * i + 1];
+        }
+    } else {
+        for(int i = 0; i <= n->num_keys; i++)
+            n->pointers[i] = UNLOADED_CHILD(pointers[i]);
+    }
+
+    return n;
+}
+
+/**
+ * Le do pk.dat um no que ainda nao esta em memoria, quando o pai eh
+ * visitado (load_node do bpt.c). Um pk.dat corrompido encerra o programa,
+ * como na abertura da tabela
+ */
+node *loadBPTNode(node *parent, int pageNo){
+    tableIndex *index = parent->owner;
+    node *n = readBPTPage(index, pageNo), *p;
+    int depth = 0;
+
+    for(p = parent; p != NULL; p = p->parent)
+        depth++;
+
+    if(n == NULL || depth > 64) {
+        printf("Index of table %s is corrupted (pk.dat)\n", index->tableName);
+        exit(EXIT_FAILURE);
+    }
+    return n;
+}
+
+/**
+ * Guarda uma pagina do pk.dat que saiu da arvore, para ser reaproveitada
+ */
+void addFreeBPTPage(tableIndex *index, int pageNo){
+    if(index->qtdFree == index->freeCapacity) {
+        index->freeCapacity = index->freeCapacity > 0 ? 2 * index->freeCapacity : 64;
+        index->freePages = realloc(index->freePages, index->freeCapacity * sizeof(int));
+        if(index->freePages == NULL) {
+            perror("Pk free pages.");
+            exit(EXIT_FAILURE);
+        }
+    }
+    index->freePages[index->qtdFree++] = pageNo;
+}
+
+/**
+ * Grava no pk.dat os nos alterados desde a ultima gravacao (a folha e os
+ * nos divididos no caminho ate a raiz), a lista de paginas livres e a
+ * pagina meta. Os nos nunca sao regravados no lugar: cada no alterado e os
+ * seus ancestrais vao para paginas livres, e a arvore anterior continua
+ * inteira no arquivo ate a pagina meta, gravada por ultimo, apontar para a
+ * nova raiz. Um checkpoint interrompido deixa a arvore anterior, completada
+ * pelas chaves do wal.log
+ */
+void flushTableBPT(tableIndex *index){
+    char pkFile[600];
+    node *n, *parent;
+    int *released, qtdReleased = 0, qtdDirty = 0, *list, qtdList;
+    int buf[PAGE_SIZE / sizeof(int)];
+
+    snprintf(pkFile, sizeof(pkFile), "%s/pk.dat", index->tableName); 
+    FILE *fp = fopen(pkFile, "rb+"); 
+
+    if(fp == NULL){
+        return;
+    }
+
+    // o pai passa a referenciar a pagina nova do filho
+    for(n = dirty_nodes; n != NULL; n = n->next_dirty) {
+        for(parent = n->parent; parent != NULL; parent = parent->parent)
+            mark_dirty(parent);
+    }
+    for(n = dirty_nodes; n != NULL; n = n->next_dirty)
+        qtdDirty++;
+
+    released = malloc((qtdDirty > 0 ? qtdDirty : 1) * sizeof(int));
+    if(released == NULL) {
+        perror("Pk released pages.");
+        exit(EXIT_FAILURE);
+    }
+
+    // cada no recebe a sua pagina antes de gravar qualquer pai, que
+    // referencia os filhos pelo numero da pagina. As paginas liberadas
+    // agora so podem ser reaproveitadas depois da troca da raiz
+    for(n = dirty_nodes; n != NULL; n = n->next_dirty) {
+        if(n->disk_page != 0)
+            released[qtdReleased++] = n->disk_page;
+        n->disk_page = index->qtdFree > 0 ? index->freePages[--index->qtdFree] : index->meta.qtdPages++;
+    }
+
+    // a lista de paginas livres da nova arvore tem as que sobraram, as
+    // liberadas agora e as da lista anterior. Ela tambem vai para paginas
+    // fora da arvore e da lista anteriores
+    qtdList = (index->qtdFree + qtdReleased + index->qtdList + PK_FREE_PER_PAGE - 1) / PK_FREE_PER_PAGE;
+    list = malloc((qtdList > 0 ? qtdList : 1) * sizeof(int));
+    if(list == NULL) {
+        perror("Pk free list pages.");
+        exit(EXIT_FAILURE);
+    }
+    for(int k = 0; k < qtdList; k++)
+        list[k] = index->qtdFree > 0 ? index->freePages[--index->qtdFree] : index->meta.qtdPages++;
+    for(int i = 0; i < qtdReleased; i++)
+        addFreeBPTPage(index, released[i]);
+    for(int i = 0; i < index->qtdList; i++)
+        addFreeBPTPage(index, index->listPages[i]);
+    free(released);
+
+    for(n = dirty_nodes; n != NULL; n = n->next_dirty) {
+        if(debug) printf("Gravando pagina %d da B+ (%d chaves)\n", n->disk_page, n->num_keys);
+        writeBPTPage(fp, n);
+    }
+
+    // cada pagina da lista: a proxima pagina, a quantidade e as paginas livres
+    for(int k = 0, pos = 0; k < qtdList; k++) {
+        memset(buf, 0, sizeof(buf));
+        buf[0] = k + 1 < qtdList ? list[k + 1] : 0;
+        buf[1] = index->qtdFree - pos < PK_FREE_PER_PAGE ? index->qtdFree - pos : PK_FREE_PER_PAGE;
+        memcpy(buf + 2, index->freePages + pos, buf[1] * sizeof(int));
+        pos += buf[1];
+        fseek(fp, (long)list[k] * PAGE_SIZE, SEEK_SET);
+        fwrite(buf, PAGE_SIZE, 1, fp);
+    }
+    fflush(fp);
+    fsync(fileno(fp));
+
+    index->meta.root = index->root != NULL ? index->root->disk_page : 0;
+    index->meta.freeList = qtdList > 0 ? list[0] : 0;
+    fseek(fp, 0, SEEK_SET);
+    fwrite(&index->meta, sizeof(pkMeta), 1, fp);
+    fflush(fp);
+    fsync(fileno(fp));
+    fclose(fp);
+
+    free(index->listPages);
+    index->listPages = list;
+    index->qtdList = qtdList;
+
+    clean_dirty_nodes();
+}
+
+/**
+ * Os nos alterados ficam na lista global dirty_nodes do bpt.c. Cada
+ * indice guarda a sua lista entre um checkpoint e outro, e a coloca na
+ * global apenas enquanto a arvore eh alterada ou gravada
+ */
+void beginTableChange(tableIndex *index){
+    dirty_nodes = index->dirtyNodes;
+}
+
+void endTableChange(tableIndex *index){
+    index->dirtyNodes = dirty_nodes;
+    dirty_nodes = NULL;
+}
+
+/**
+ * Reaplica na arvore as chaves de um pk.log deixado por versoes anteriores,
+ * que guardavam nele as chaves inseridas apos o ultimo checkpoint, e o
+ * remove depois de gravar a arvore. Hoje essas chaves sao refeitas a partir
+ * do wal.log. Chaves que ja estao na arvore e um registro incompleto no
+ * final sao ignorados
+ */
+void replayTableLog(tableIndex *index){
+    char logFile[600];
+    pkEntry entry;
+    int qtdKeys = 0;
+
+    snprintf(logFile, sizeof(logFile), "%s/pk.log", index->tableName);
+    FILE *fp = fopen(logFile, "rb");
+
+    if(fp == NULL)
+        return;
+
+    beginTableChange(index);
+    while(fread(&entry, sizeof(pkEntry), 1, fp) == 1) {
+        if(find(index->root, entry.key, false, NULL) != NULL)
+            continue;
+        index->root = insert(index->root, index->meta.order, entry.key, entry.rec.page, entry.rec.offset);
+        index->meta.qtdKeys++;
+        if(index->filter != NULL)
+            addTableBloom(index, entry.key);
+        qtdKeys++;
+    }
+    endTableChange(index);
+    fclose(fp);
+
+    if(debug) printf("%d chaves reaplicadas do pk.log da tabela %s\n", qtdKeys, index->tableName);
+
+    checkpointTableBPT(index);
+    remove(logFile);
+}
+
+/**
+ * Grava no pk.dat os nos alterados desde o ultimo checkpoint e o filtro de
+ * Bloom. As chaves inseridas depois do checkpoint anterior estao no
+ * wal.log, que so eh esvaziado apos o checkpoint de todos os indices
+ * (checkpointWal)
+ */
+void checkpointTableBPT(tableIndex *index){
+    if(index->dirtyNodes == NULL)
+        return;
+
+    beginTableChange(index);
+    flushTableBPT(index);
+    endTableChange(index);
+
+    if(index->filter != NULL)
+        saveTableBloom(index);
+
+    if(debug) printf("Checkpoint do indice da tabela %s\n", index->tableName);
+}
+
+void checkpointAllTables(void){
+    tableIndex *index;
+
+    for(index = indexCache; index != NULL; index = index->next)
+        checkpointTableBPT(index);
+}
+
+/**
+ * Quando as arvores passam de PK_CACHE_NODES nos em memoria, grava os nos
+ * alterados e tira da memoria os nos abaixo das raizes. O wal.log vai antes
+ * para o disco, ja que o pk.dat gravado aponta para os registros inseridos
+ */
+void trimAllTables(void){
+    tableIndex *index;
+
+    if(live_nodes <= PK_CACHE_NODES)
+        return;
+
+    wal_flush();
+    for(index = indexCache; index != NULL; index = index->next) {
+        checkpointTableBPT(index);
+        if(index->root == NULL || index->fd < 0)
+            continue;
+        index->root->owner = index;
+        for(int i = 0; !index->root->is_leaf && i <= index->root->num_keys; i++)
+            unload_child(index->root, i);
+        index->lastLeaf = NULL;
+    }
+
+    if(debug) printf("%ld nos das arvores B+ em memoria\n", live_nodes);
+}
+
+/**
+ * Inicia o registro do wal.log de um insert, reservando o cabecalho e
+ * gravando o nome da tabela
+ */
+void walBegin(walChange *change, char *tableName){
+    change->nameLen = strlen(tableName);
+    memcpy(change->data + sizeof(walInsert), tableName, change->nameLen);
+    change->len = sizeof(walInsert) + change->nameLen;
+}
+
+/**
+ * Acrescenta ao registro do wal.log os trechos da pagina que mudaram em
+ * relacao a copia before. Trechos separados por menos de 8 bytes iguais
+ * sao gravados juntos
+ */
+void walPageChange(walChange *change, char *before, char *page, int numPage){
+    walRange range;
+    int start, end, equal;
+
+    for(start = 0; start < PAGE_SIZE; start = end) {
+        while(start + 64 <= PAGE_SIZE && memcmp(before + start, page + start, 64) == 0)
+            start += 64;
+        while(start < PAGE_SIZE && before[start] == page[start])
+            start++;
+        if(start == PAGE_SIZE)
+            break;
+
+        for(end = start + 1, equal = 0; end < PAGE_SIZE && equal < 8; end++)
+            equal = before[end] == page[end] ? equal + 1 : 0;
+        end -= equal;
+
+        range.page = numPage;
+        range.offset = start;
+        range.len = end - start;
+        memcpy(change->data + change->len, &range, sizeof(walRange));
+        memcpy(change->data + change->len + sizeof(walRange), page + start, range.len);
+        change->len += sizeof(walRange) + range.len;
+    }
+}
+
+/**
+ * Grava o cabecalho e as chaves e acrescenta o registro ao wal.log,
+ * retornando a posicao que precisa ser confirmada (wal_commit) para ele ser
+ * duravel
+ */
+long walEnd(walChange *change, walInsert *head, entry keys[], int qtdKeys){
+    char *data;
+    long lsn;
+
+    head->nameLen = change->nameLen;
+    head->qtdKeys = qtdKeys;
+    if(qtdKeys == 1) {
+        head->key = keys[0].key;
+        head->page = keys[0].value.page;
+        head->offset = keys[0].value.offset;
+    }
+    memcpy(change->data, head, sizeof(walInsert));
+    if(qtdKeys <= 1)
+        return wal_append(change->data, change->len);
+
+    // as chaves vao no final de um registro do tamanho necessario
+    data = malloc(change->len + qtdKeys * sizeof(entry));
+    if(data == NULL) {
+        perror("Write-ahead log record.");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(data, change->data, change->len);
+    memcpy(data + change->len, keys, qtdKeys * sizeof(entry));
+    lsn = wal_append(data, change->len + qtdKeys * sizeof(entry));
+    free(data);
+    return lsn;
+}
+
+/**
+ * Refaz um insert do wal.log na abertura: regrava os valores do header.dat
+ * e os trechos das paginas e insere as chaves no indice se elas ainda nao
+ * estiverem la. Reaplicar um registro ja gravado nao muda nada
+ */
+void redoInsert(const char *data, int len){
+    char tableName[500], headerName[600];
+    walInsert head;
+    walRange range;
+    entry key;
+    int qtdFields, pos, end;
+    tableIndex *index;
+
+    memcpy(&head, data, sizeof(walInsert));
+    memset(tableName, '\0', sizeof(tableName));
+    memcpy(tableName, data + sizeof(walInsert), head.nameLen);
+    pos = sizeof(walInsert) + head.nameLen; // inicio dos trechos das paginas
+
+    snprintf(headerName, sizeof(headerName), "%s/header.dat", tableName);
+    FILE *headerPage = fopen(headerName, "rb+");
+    if(!headerPage)
+        return;
+
+    // o valor do ai, a quantidade de paginas e a ultima pagina vem logo apos
+    // os campos, de 28 bytes cada
+    fread(&qtdFields, sizeof(int), 1, headerPage);
+    fseek(headerPage, sizeof(int) + 28 * qtdFields, SEEK_SET);
+    fwrite(&head.aiValue, sizeof(int), 1, headerPage);
+    fwrite(&head.qtdPages, sizeof(int), 1, headerPage);
+    fwrite(&head.lastPage, sizeof(int), 1, headerPage);
+    fclose(headerPage);
+
+    // as chaves, quando mais de uma, ficam no final do registro
+    end = head.qtdKeys > 1 ? len - head.qtdKeys * (int)sizeof(entry) : len;
+    while(pos < end) {
+        memcpy(&range, data + pos, sizeof(walRange));
+        char *page = pin_page(tableName, range.page);
+        memcpy(page + range.offset, data + pos + sizeof(walRange), range.len);
+        unpin_page(tableName, range.page, true);
+        pos += sizeof(walRange) + range.len;
+    }
+
+    index = head.qtdKeys > 0 ? getTableIndex(tableName) : NULL;
+    for(int k = 0; index != NULL && k < head.qtdKeys; k++) {
+        if(head.qtdKeys == 1) {
+            key.key = head.key;
+            key.value.page = head.page;
+            key.value.offset = head.offset;
+        } else
+            memcpy(&key, data + end + k * sizeof(entry), sizeof(entry));
+        if(find(index->root, key.key, false, NULL) != NULL)
+            continue;
+
+        beginTableChange(index);
+        index->root = insert(index->root, index->meta.order, key.key, key.value.page, key.value.offset);
+        endTableChange(index);
+        index->meta.qtdKeys++;
+        if(index->filter != NULL)
+            addTableBloom(index, key.key);
+    }
+
+    addChangedTable(tableName);
+}
+
+void addChangedTable(char *tableName){
+    changedTable *table;
+
+    for(table = changedTables; table != NULL; table = table->next)
+        if(strcmp(table->tableName, tableName) == 0)
+            return;
+
+    table = malloc(sizeof(changedTable));
+    strcpy(table->tableName, tableName);
+    table->next = changedTables;
+    changedTables = table;
+}
+
+void syncTableFile(char *tableName, char *fileName){
+    char path[600];
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/%s", tableName, fileName);
+    fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return;
+    fsync(fd);
+    close(fd);
+}
+
+/**
+ * Checkpoint do wal.log: grava e sincroniza as paginas alteradas, os indices
+ * e os cabecalhos das tabelas alteradas, e so entao esvazia o wal.log
+ */
+void checkpointWal(void){
+    changedTable *table;
+
+    wal_flush();
+    sync_pages();
+    checkpointAllTables();
+
+    while((table = changedTables) != NULL) {
+        syncTableFile(table->tableName, "header.dat");
+        syncTableFile(table->tableName, "pk.dat");
+        changedTables = table->next;
+        free(table);
+    }
+
+    wal_truncate();
+    if(debug) printf("Checkpoint do wal.log\n");
+}
+
+/**
+ * Retorna o indice da tabela, carregando o pk.dat apenas no primeiro acesso
+ */
+tableIndex *getTableIndex(char *tableName){
+    tableIndex *index;
+
+    for(index = indexCache; index != NULL; index = index->next) {
+        if(strcmp(index->tableName, tableName) == 0)
+            return index;
+    }
+
+    index = malloc(sizeof(tableIndex));
+    if(index == NULL) {
+        perror("Table index creation.");
+        exit(EXIT_FAILURE);
+    }
+
+    strcpy(index->tableName, tableName);
+    index->lastLeaf = NULL;
+    index->dirtyNodes = NULL;
+    index->freePages = NULL;
+    index->qtdFree = 0;
+    index->freeCapacity = 0;
+    index->listPages = NULL;
+    index->qtdList = 0;
+    loadTableBPT(index);
+    loadTableBloom(index);
+    replayTableLog(index);
+    index->next = indexCache;
+    indexCache = index;
+
+    return index;
+}
+
+int comparePkEntry(const void *a, const void *b){
+    const pkEntry *x = a, *y = b;
+    return (x->key > y->key) - (x->key < y->key);
+}
+
+/**
+ * Abre a arvore do pk.dat, lendo apenas a raiz e a lista de paginas livres:
+ * os demais nos sao lidos quando visitados. Arquivos no formato antigo
+ * (quantidade seguida das triplas key, page, offset) sao convertidos para
+ * o paginado
+ */
+void loadTableBPT(tableIndex *index){
+    char pkDataFIle[600];
+    int i, pageNo;
+    int buf[PAGE_SIZE / sizeof(int)];
+    pkEntry *entries;
+    bulk_loader loader;
+
+    index->root = NULL;
+    memset(&index->meta, 0, sizeof(pkMeta));
+
+    snprintf(pkDataFIle, sizeof(pkDataFIle), "%s/pk.dat", index->tableName); //define o caminho da pagina de determinada tabela
+
+    FILE *fp = fopen(pkDataFIle, "rb"); // abre o indice da tabela como leitura binária
+    index->fd = open(pkDataFIle, O_RDONLY);
+
+    if(fp == NULL){
+        if(debug) printf("Pk da tabela %s não existe\n", index->tableName);
+        return;
+    }
+
+    // o pk.dat de uma tabela nova tem apenas a meta, e a de arquivos
+    // gravados antes da lista de paginas livres nao tem o campo (0)
+    fread(&index->meta, sizeof(pkMeta), 1, fp);
+
+    if(index->meta.magic == PK_MAGIC) {
+        fclose(fp);
+        if(index->meta.order < MIN_ORDER || index->meta.order > PK_ORDER || index->meta.qtdPages < 1) {
+            printf("Index of table %s is corrupted (pk.dat)\n", index->tableName);
+            exit(EXIT_FAILURE);
+        }
+
+        if(index->meta.root != 0) {
+            index->root = readBPTPage(index, index->meta.root);
+            if(index->root == NULL) {
+                printf("Index of table %s is corrupted (pk.dat)\n", index->tableName);
+                exit(EXIT_FAILURE);
+            }
+            index->root->owner = index;
+        }
+
+        // paginas deixadas por checkpoints anteriores, fora da arvore atual
+        for(pageNo = index->meta.freeList; pageNo != 0; pageNo = buf[0]) {
+            if(pageNo < 0 || pageNo >= index->meta.qtdPages || index->qtdList >= index->meta.qtdPages ||
+                pread(index->fd, buf, PAGE_SIZE, (off_t)pageNo * PAGE_SIZE) != PAGE_SIZE ||
+                buf[1] < 0 || buf[1] > PK_FREE_PER_PAGE) {
+                printf("Index of table %s is corrupted (pk.dat)\n", index->tableName);
+                exit(EXIT_FAILURE);
+            }
+            index->listPages = realloc(index->listPages, (index->qtdList + 1) * sizeof(int));
+            if(index->listPages == NULL) {
+                perror("Pk free list pages.");
+                exit(EXIT_FAILURE);
+            }
+            index->listPages[index->qtdList++] = pageNo;
+            for(i = 0; i < buf[1]; i++)
+                addFreeBPTPage(index, buf[2 + i]);
+        }
+    } else {
+        // formato antigo: o primeiro inteiro eh a quantidade de registros,
+        // as chaves sao ordenadas e a arvore eh montada de baixo para cima
+        int idCount = index->meta.magic;
+        entries = malloc((idCount > 0 ? idCount : 1) * sizeof(pkEntry));
+        if(entries == NULL) {
+            perror("Pk entries array.");
+            exit(EXIT_FAILURE);
+        }
+        fseek(fp, sizeof(int), SEEK_SET);
+        idCount = fread(entries, sizeof(pkEntry), idCount, fp);
+        fclose(fp);
+
+        qsort(entries, idCount, sizeof(pkEntry), comparePkEntry);
+        bulk_load_start(&loader, PK_ORDER, PK_FILL_FACTOR);
+        for (i = 0; i < idCount; i++)
+            bulk_load_add(&loader, entries[i].key, entries[i].rec.page, entries[i].rec.offset);
+        index->root = bulk_load_finish(&loader);
+        free(entries);
+
+        pkMeta meta = { PK_MAGIC, PK_ORDER, 0, 1, idCount, 0 };
+        index->meta = meta;
+        fp = fopen(pkDataFIle, "wb");
+        fwrite(&index->meta, sizeof(pkMeta), 1, fp);
+        fclose(fp);
+        flushTableBPT(index);
+    }
+
+    if(debug) printf("Pk da tabela %s foi carregada com sucesso\n", index->tableName);
+}
+
+/**
+ * Carrega o filtro de Bloom do pk.bloom, se a tabela usar um. Um filtro
+ * que nao acompanha a arvore (gravacao interrompida) eh refeito a partir
+ * das folhas
+ */
+void loadTableBloom(tableIndex *index){
+    char bloomFile[600];
+    bloomMeta meta;
+
+    index->filter = NULL;
+
+    snprintf(bloomFile, sizeof(bloomFile), "%s/pk.bloom", index->tableName);
+    FILE *fp = fopen(bloomFile, "rb");
+
+    if(fp == NULL)
+        return;
+
+    if(fread(&meta, sizeof(bloomMeta), 1, fp) != 1 || meta.magic != BLOOM_MAGIC || meta.numKeys != index->meta.qtdKeys) {
+        fclose(fp);
+        if(debug) printf("Filtro de Bloom da tabela %s desatualizado, refazendo\n", index->tableName);
+        rebuildTableBloom(index, index->meta.qtdKeys * 2);
+        return;
+    }
+
+    index->filter = bloom_create(meta.capacity);
+    fread(index->filter->blocks, BLOOM_BLOCK_WORDS * sizeof(uint64_t), index->filter->num_blocks, fp);
+    index->filter->num_keys = meta.numKeys;
+    fclose(fp);
+}
+
+/**
+ * Grava o filtro inteiro no pk.bloom
+ */
+void saveTableBloom(tableIndex *index){
+    char bloomFile[600];
+    bloomMeta meta = { BLOOM_MAGIC, index->filter->num_blocks, index->filter->capacity, index->filter->num_keys };
+
+    snprintf(bloomFile, sizeof(bloomFile), "%s/pk.bloom", index->tableName);
+    FILE *fp = fopen(bloomFile, "wb");
+
+    if(fp == NULL)
+        return;
+
+    fwrite(&meta, sizeof(bloomMeta), 1, fp);
+    fwrite(index->filter->blocks, BLOOM_BLOCK_WORDS * sizeof(uint64_t), index->filter->num_blocks, fp);
+    fclose(fp);
+}
+
+/**
+ * Adiciona ao filtro as chaves das folhas abaixo de n. Os nos que nao
+ * estavam em memoria sao lidos e liberados logo em seguida, sem carregar
+ * a arvore inteira
+ */
+void addBloomSubtree(bloom *filter, node *n){
+    bool unloaded;
+
+    if(n->is_leaf) {
+        for(int i = 0; i < n->num_keys; i++)
+            bloom_add(filter, n->keys[i]);
+        return;
+    }
+
+    for(int i = 0; i <= n->num_keys; i++) {
+        unloaded = UNLOADED(n->pointers[i]);
+        addBloomSubtree(filter, get_child(n, i));
+        if(unloaded)
+            unload_child(n, i);
+    }
+}
+
+/**
+ * Refaz o filtro com espaco para capacity chaves percorrendo as folhas
+ */
+void rebuildTableBloom(tableIndex *index, int capacity){
+    if(index->filter != NULL)
+        bloom_destroy(index->filter);
+    index->filter = bloom_create(capacity);
+
+    if(index->root != NULL)
+        addBloomSubtree(index->filter, index->root);
+
+    saveTableBloom(index);
+}
+
+/**
+ * Adiciona a chave ao filtro, que eh gravado no checkpoint. Quando o
+ * filtro passa da capacidade ele eh refeito com o dobro do tamanho, para
+ * manter a taxa de falsos positivos
+ */
+void addTableBloom(tableIndex *index, int key){
+    bloom_add(index->filter, key);
+
+    if(index->filter->num_keys > index->filter->capacity)
+        rebuildTableBloom(index, index->filter->capacity * 2);
+}
+
+/**
+ * Adiciona ao filtro as chaves de um insert de varios registros ou de um
+ * copy, que ja estao na arvore. O filtro eh refeito no maximo uma vez, depois de todas
+ * as chaves: refeito no meio, ele ja leria da arvore as chaves seguintes,
+ * que seriam contadas duas vezes
+ */
+void addTableBloomKeys(tableIndex *index, entry keys[], long qtdKeys){
+    int capacity = index->filter->capacity;
+
+    for(long k = 0; k < qtdKeys; k++)
+        bloom_add(index->filter, keys[k].key);
+
+    if(index->filter->num_keys > capacity) {
+        while(capacity < index->filter->num_keys)
+            capacity *= 2;
+        rebuildTableBloom(index, capacity);
+    }
+}
+
+/**
+ * Escreve o cabecalho de uma pagina vazia. Os dados sao gravados do final
+ * para o inicio, a partir do byte 8191 (o caracter special)
+ */
+void initPage(char *page, int pageFormat){
+    header head = { 8180, 8191, 0 };
+    unsigned short qtdSlots = 0, dataStart = 8191;
+
+    if(pageFormat == 1) {
+        memcpy(page, &head.memFree, sizeof(int));  // quantidade de memória disponível
+        memcpy(page + 4, &head.next, sizeof(int));     // onde inserir o proximo elemento
+        memcpy(page + 8, &head.qtdItems, sizeof(int)); // n elementos
+    } else {
+        if(pageFormat == PAGE_FORMAT_PAX)
+            dataStart = 0; // capacidade definida no primeiro registro
+        memcpy(page, &qtdSlots, 2);
+        memcpy(page + 2, &dataStart, 2);
+    }
+    if(pageFormat == PAGE_FORMAT_COMPRESSED) {
+        memcpy(page + 2, &qtdSlots, 2); // nenhum registro codificado
+        dataStart = 6; // os dados codificados comecam apos o cabecalho
+        memcpy(page + 4, &dataStart, 2);
+    }
+}
+
+/**
+ * Verifica se um registro de size bytes e o seu slot cabem na pagina
+ */
+int pageFits(char *page, int pageFormat, int size){
+    header head;
+    unsigned short qtdSlots, dataStart, qtdEncoded;
+
+    if(pageFormat == 1) {
+        memcpy(&head.memFree, page, sizeof(int));
+        memcpy(&head.next, page + 4, sizeof(int));
+        memcpy(&head.qtdItems, page + 8, sizeof(int));
+        return head.memFree > size && 12 + 12 * (head.qtdItems + 1) <= head.next - size;
+    }
+
+    if(pageFormat == PAGE_FORMAT_COMPRESSED) {
+        memcpy(&qtdSlots, page, 2);
+        memcpy(&qtdEncoded, page + 2, 2);
+        memcpy(&dataStart, page + 4, 2);
+        return qtdSlots < COMPRESSED_MAX_ROWS && dataStart + (qtdSlots - qtdEncoded + 1) * size <= 8191;
+    }
+
+    // na pagina pax o segundo campo do cabecalho eh a capacidade, definida
+    // pelo tamanho do primeiro registro
+    if(pageFormat == PAGE_FORMAT_PAX) {
+        memcpy(&qtdSlots, page, 2);
+        memcpy(&dataStart, page + 2, 2);
+        return dataStart == 0 ? 4 + size <= 8191 : qtdSlots < dataStart;
+    }
+
+    memcpy(&qtdSlots, page, 2);
+    memcpy(&dataStart, page + 2, 2);
+    return 4 + (int)sizeof(slot) * (qtdSlots + 1) <= dataStart - size;
+}
+
+/**
+ * Reserva na pagina o espaco de um registro de size bytes e o seu slot,
+ * retornando a posicao do registro
+ */
+int addPageRow(char *page, int pageFormat, int size){
+    header head;
+    item newItem;
+    slot newSlot;
+    unsigned short qtdSlots, dataStart;
+
+    if(pageFormat == 1) {
+        memcpy(&head.memFree, page, sizeof(int));
+        memcpy(&head.next, page + 4, sizeof(int));
+        memcpy(&head.qtdItems, page + 8, sizeof(int));
+
+        newItem.offset = head.next - size;
+        newItem.totalLen = size;
+        newItem.writed = 1;
+        memcpy(page + 12 + 12 * head.qtdItems, &newItem, sizeof(item));
+
+        head.memFree -= size;
+        head.next = newItem.offset;
+        head.qtdItems++;
+        memcpy(page, &head.memFree, sizeof(int));
+        memcpy(page + 4, &head.next, sizeof(int));
+        memcpy(page + 8, &head.qtdItems, sizeof(int));
+        return newItem.offset;
+    }
+
+    if(pageFormat == PAGE_FORMAT_COMPRESSED) {
+        memcpy(&qtdSlots, page, 2);
+        qtdSlots++;
+        memcpy(page, &qtdSlots, 2);
+        return qtdSlots - 1;
+    }
+
+    if(pageFormat == PAGE_FORMAT_PAX) {
+        memcpy(&qtdSlots, page, 2);
+        memcpy(&dataStart, page + 2, 2);
+        if(dataStart == 0) {
+            dataStart = (8191 - 4) / size; // registros que cabem na pagina
+            memcpy(page + 2, &dataStart, 2);
+        }
+        qtdSlots++;
+        memcpy(page, &qtdSlots, 2);
+        return qtdSlots - 1;
+    }
+
+    memcpy(&qtdSlots, page, 2);
+    memcpy(&dataStart, page + 2, 2);
+
+    newSlot.offset = dataStart - size;
+    newSlot.len = size | SLOT_USED;
+    memcpy(page + 4 + sizeof(slot) * qtdSlots, &newSlot, sizeof(slot));
+
+    qtdSlots++;
+    dataStart = newSlot.offset;
+    memcpy(page, &qtdSlots, 2);
+    memcpy(page + 2, &dataStart, 2);
+    return newSlot.offset;
 }
 
+int pageRowCount(char *page, int pageFormat){
+    int qtdItems;
+    unsigned short qtdSlots;
 
-void selectFrom(char *sql, int numPage) {
-    char tableName[50], sqlCopy[1000], pageName[600], *token, charInFile, special = ' ';
-    int i = 0, qtdFields = 0, moveItem = 0, moveTupla = 0, intInFile, stopChar;
+    if(pageFormat == 1) {
+        memcpy(&qtdItems, page + 8, sizeof(int));
+        return qtdItems;
+    }
+    memcpy(&qtdSlots, page, 2);
+    return qtdSlots;
+}
 
+/**
+ * Retorna a posicao do registro do slot, ou -1 se nada foi gravado nele
+ */
+int pageRowOffset(char *page, int pageFormat, int slotNo){
     item readItem;
-    attribute attributes[64];
-    memset(sqlCopy, '\0', sizeof(sqlCopy));
+    slot readSlot;
+
+    if(pageFormat == 1) {
+        memcpy(&readItem, page + sizeof(item) * (slotNo + 1), sizeof(item));
+        return readItem.writed ? readItem.offset : -1;
+    }
+    if(pageFormat >= PAGE_FORMAT_PAX)
+        return slotNo;
+    memcpy(&readSlot, page + 4 + sizeof(slot) * slotNo, sizeof(slot));
+    return readSlot.len & SLOT_USED ? readSlot.offset : -1;
+}
+
+/**
+ * Retorna o valor do campo field do registro slotNo de uma pagina pax. A
+ * minipagina do campo comeca apos as minipaginas dos campos anteriores,
+ * cada uma com espaco para a capacidade da pagina
+ */
+char *paxField(char *page, rowLayout *layout, attribute attributes[], int slotNo, int field){
+    unsigned short capacity;
+
+    memcpy(&capacity, page + 2, 2);
+    return page + 4 + capacity * layout->offset[field] + slotNo * attributes[field].size;
+}
+
+/**
+ * Retorna a posicao de um registro ainda nao codificado de uma pagina
+ * comprimida. Esses registros sao gravados do final da pagina para o inicio
+ */
+int tailRowOffset(char *page, int slotNo, int size){
+    unsigned short qtdEncoded;
+
+    memcpy(&qtdEncoded, page + 2, 2);
+    return 8191 - (slotNo - qtdEncoded + 1) * size;
+}
+
+/**
+ * Decodifica todos os registros de uma pagina comprimida em um buffer
+ * alocado (liberado por quem chama), organizado como uma pagina pax: os
+ * valores do campo j de todos os registros em sequencia, a partir de
+ * qtdRegistros * layout->offset[j]
+ */
+char *decodePage(char *page, attribute attributes[], int qtdFields, rowLayout *layout){
+    unsigned short qtdSlots, qtdEncoded;
+    int pos = 6, rowSize = layout->varTable;
+    char *rows, *column;
+
+    memcpy(&qtdSlots, page, 2);
+    memcpy(&qtdEncoded, page + 2, 2);
+
+    rows = malloc((size_t)(qtdSlots > 0 ? qtdSlots : 1) * rowSize);
+    if(rows == NULL) {
+        perror("Decoded page.");
+        exit(EXIT_FAILURE);
+    }
+
+    for(int j = 0; j < qtdFields; j++) {
+        column = rows + (size_t)qtdSlots * layout->offset[j];
+        pos += decode_column(page + pos, attributes[j].type, attributes[j].size, qtdEncoded, column);
+
+        // registros ainda nao codificados
+        for(int i = qtdEncoded; i < qtdSlots; i++)
+            memcpy(column + (size_t)i * attributes[j].size, page + tailRowOffset(page, i, rowSize) + layout->offset[j], attributes[j].size);
+    }
+    return rows;
+}
+
+/**
+ * Codifica de novo todos os registros de uma pagina comprimida, incluindo os
+ * que ainda estao inteiros no final dela. Retorna 1 se a pagina ficou menor
+ * e foi regravada, 0 se ela continua como estava
+ */
+int compressPage(char *page, attribute attributes[], int qtdFields, rowLayout *layout){
+    unsigned short qtdSlots, qtdEncoded, dataEnd;
+    char encoded[PAGE_SIZE], *rows;
+    int pos = 6, len = 0;
+
+    memcpy(&qtdSlots, page, 2);
+    memcpy(&qtdEncoded, page + 2, 2);
+    memcpy(&dataEnd, page + 4, 2);
+    if(qtdSlots == qtdEncoded)
+        return 0;
+
+    rows = decodePage(page, attributes, qtdFields, layout);
+    for(int j = 0; j < qtdFields && len >= 0; j++) {
+        len = encode_column(attributes[j].type, attributes[j].size, rows + (size_t)qtdSlots * layout->offset[j], qtdSlots, encoded + pos, 8191 - pos);
+        pos += len;
+    }
+    free(rows);
+
+    // so vale regravar se ocupar menos que os dados codificados e os registros inteiros
+    if(len < 0 || pos >= dataEnd + (qtdSlots - qtdEncoded) * layout->varTable)
+        return 0;
+
+    memcpy(page + 6, encoded + 6, pos - 6);
+    dataEnd = pos;
+    memcpy(page + 2, &qtdSlots, 2);
+    memcpy(page + 4, &dataEnd, 2);
+    return 1;
+}
 
-    strcpy(sqlCopy, sql);
+/**
+ * Calcula a posicao dos campos de tamanho fixo e o indice dos varchar na
+ * tabela de offsets de um registro no formato 2
+ */
+void buildRowLayout(rowLayout *layout, attribute attributes[], int qtdFields, int format){
+    int pos = 0;
+
+    layout->format = format;
+    layout->qtdVar = 0;
+    for(int i = 0; i < qtdFields; i++) {
+        if(attributes[i].type == 'V') {
+            layout->offset[i] = layout->qtdVar++;
+        } else {
+            layout->offset[i] = pos;
+            pos += attributes[i].size;
+        }
+    }
+    layout->varTable = pos;
+}
 
-    token = strtok(sqlCopy, " "); // separa o script em sql usando o espaço como delimitador
+/**
+ * Retorna o inicio do campo field de um registro no formato 2 e o seu
+ * tamanho em len, sem percorrer os campos anteriores
+ */
+char *rowField(char *row, rowLayout *layout, attribute attributes[], int field, int *len){
+    unsigned short varOffset, varLen;
+
+    if(attributes[field].type != 'V') {
+        *len = attributes[field].size;
+        return row + layout->offset[field];
+    }
 
-    while(token != NULL) { // procura o nome da tabela
-        // Se i == 3 então o token vai ser igual o nome da tabela
-        if(i == 3) {
-            token = strtok(token, "\n");
-            strcpy(tableName, token);
+    memcpy(&varOffset, row + layout->varTable + 2 * layout->offset[field], 2);
+    memcpy(&varLen, row + varOffset, 2);
+    *len = varLen;
+    return row + varOffset + 2;
+}
+
+/**
+ * Imprime o registro que comeca em offset (o slot, nas paginas pax e
+ * comprimidas). Nas paginas comprimidas os campos sao lidos de rows, os
+ * qtdSlots registros da pagina ja decodificados
+ */
+void printRow(char *page, int pageFormat, attribute attributes[], int qtdFields, rowLayout *layout, char *rows, int qtdSlots, int offset){
+    int intInFile, stopChar, len;
+    char *ptr, *end;
+
+    ptr = page + offset; // posiciona no offset do item
+
+    // no formato 2 cada campo eh encontrado direto pela sua posicao
+    // ou pela tabela de offsets, sem percorrer os anteriores
+    for(int j = 0; j < qtdFields && layout->format >= 2; j++) {
+        char *field;
+        if(pageFormat == PAGE_FORMAT_COMPRESSED) {
+            field = rows + (size_t)qtdSlots * layout->offset[j] + (size_t)offset * attributes[j].size;
+            len = attributes[j].size;
+        } else if(pageFormat == PAGE_FORMAT_PAX) {
+            field = paxField(page, layout, attributes, offset, j);
+            len = attributes[j].size;
         } else
-            token = strtok(NULL, " "); 
-        i++;
+            field = rowField(page + offset, layout, attributes, j, &len);
+        if(attributes[j].type == 'I') {
+            memcpy(&intInFile, field, sizeof(int));
+            printf("%d\t", intInFile);
+        } else {
+            // char termina no primeiro '\0' ou no tamanho do campo
+            end = attributes[j].type == 'C' ? memchr(field, '\0', len) : NULL;
+            printf("%.*s\t", end != NULL ? (int)(end - field) : len, field);
+        }
     }
 
-    //printf("\nTable selected - %s\n", tableName);
+    // percorre os campos da tabela
+    for(int j = 0; j < qtdFields && layout->format < 2; j++) {  
+        // se o atributo for char, imprime ate o '\0' que indica o final do campo
+        if(attributes[j].type == 'C') { 
+            end = memchr(ptr, '\0', attributes[j].size);
+            stopChar = end != NULL ? end - ptr : attributes[j].size;
+            printf("%.*s\t", stopChar, ptr);
+            ptr += attributes[j].size;
+
+        // se o atributo for int
+        } else if(attributes[j].type == 'I') {
+            memcpy(&intInFile, ptr, sizeof(int));
+            ptr += sizeof(int);
+            printf("%d\t", intInFile);
+        // se o atributo for varchar
+        } else if(attributes[j].type == 'V') {
+            // imprime ate o $, q delimita o fim de varchar
+            end = memchr(ptr, '$', page + PAGE_SIZE - ptr);
+            if(end == NULL)
+                end = page + PAGE_SIZE;
+            printf("%.*s\t", (int)(end - ptr), ptr);
+            ptr = end + 1;
+        }
+    }
+    printf("\n");
+}
 
-    snprintf(pageName, sizeof(pageName), "%s/header.dat", tableName); // procura o arquivo do cabeçalho da tabela
+/**
+ * Verifica se o campo do where de um select eh a pk da tabela, a unica
+ * busca por campo suportada. Retorna 0 e imprime o erro se nao for
+ */
+int checkSelectKey(tableSchema *schema, sql_statement *statement){
+    // a pk eh sempre o primeiro campo
+    if(!schema->pkFieldExist || !sql_view_equals(statement->where, schema->attributes[0].name)) {
+        printf("Field %.*s is not the primary key of %s\n", statement->where.len, statement->where.start, schema->tableName);
+        return 0;
+    }
+    return 1;
+}
 
-    FILE *headerPage = fopen(pageName, "rb+"); // abre o arquivo do cabeçalho da tabela
-    if(!headerPage) { // caso nao consiga abrir
-        printf("Table '%s' doesn't exist\n", tableName);
+/**
+ * select com "where <pk> = valor": a chave eh buscada na arvore da pk e so
+ * a pagina do registro eh lida, sem percorrer as paginas da tabela
+ */
+void selectByKey(sql_statement *statement, tableSchema *schema){
+    char *tableName = schema->tableName;
+    attribute *attributes = schema->attributes;
+    sql_token *value = &statement->values[0];
+    char *page, *rows = NULL;
+    record *found;
+
+    if(!checkSelectKey(schema, statement))
+        return;
+    if(value->type != TOKEN_NUMBER) {
+        printf("Field %s expects an integer\n", attributes[0].name);
         return;
     }
 
-    fread(&qtdFields, sizeof(int), 1, headerPage); // le a quantidade de campos
+    for(int i = 0; i < schema->qtdFields; i++)
+        printf("%s\t", attributes[i].name);
+    printf("\n");
 
-    //printf("Quantidade de campos: %d\n", qtdFields);
+    found = find(schema->index->root, (int)value->number, false, NULL);
+    if(found == NULL)
+        return;
 
-    for(int i = 0; i < qtdFields; i++) { // laço percorrendo a quantidade de campos (sempre vai imprimir todos os campos)
-        fread(&attributes[i].type, 1, 1, headerPage); // le o tipo do campo
-        fread(&attributes[i].size, sizeof(int), 1, headerPage); // le o tamanho do campo
-        fread(attributes[i].name, 15, 1, headerPage); // lê o nome do campo no cabeçalho
-        printf("%s\t", attributes[i].name); // printa o nome do campo + tab
-        fread(&attributes[i].pk, sizeof(int), 1, headerPage);
-        fread(&attributes[i].ai, sizeof(int), 1, headerPage);
+    page = pin_page(tableName, found->page);
+    if(schema->pageFormat == PAGE_FORMAT_COMPRESSED)
+        rows = decodePage(page, attributes, schema->qtdFields, &schema->layout);
+    printRow(page, schema->pageFormat, attributes, schema->qtdFields, &schema->layout, rows, pageRowCount(page, schema->pageFormat), found->offset);
+    free(rows);
+    unpin_page(tableName, found->page, false);
+}
+
+void selectFrom(sql_statement *statement) {
+    tableSchema *schema = statementSchema(statement); // cabecalho lido uma unica vez, no primeiro acesso
+
+    if(schema != NULL)
+        selectRows(schema, statement);
+}
+
+/**
+ * Imprime os registros de um select na tabela do schema, ja resolvida pelo
+ * select ou guardada pelo prepare
+ */
+void selectRows(tableSchema *schema, sql_statement *statement) {
+    char *tableName, special = ' ';
+    int qtdFields, qtdSlots, numPage, pageFormat, pinned;
+    rowLayout *layout;
+
+    item readItem;
+    attribute *attributes;
+
+    if(statement->where.len > 0) {
+        selectByKey(statement, schema);
+        return;
     }
+
+    tableName = schema->tableName;
+    qtdFields = schema->qtdFields;
+    pageFormat = schema->pageFormat;
+    attributes = schema->attributes;
+    layout = &schema->layout;
+
+    for(int i = 0; i < qtdFields; i++) // sempre imprime todos os campos
+        printf("%s\t", attributes[i].name); // printa o nome do campo + tab
     printf("\n");
 
-    fclose(headerPage);
+    // tabelas com data.dat sao lidas direto do arquivo mapeado em memoria,
+    // as demais pelo buffer pool
+    size_t mapSize = 0;
+    char *map = map_table_file(tableName, &mapSize);
+    char *page;
 
-    snprintf(pageName, sizeof(pageName), "%s/page%d.dat", tableName, numPage); // define o nome da pagina da tabela
-    FILE *page = fopen(pageName, "rb+"); // abre a pagina da tabela em modo de leitura e escrita binaria
+    char *rows = NULL; // registros decodificados de uma pagina comprimida
 
-    header head;
+    for(numPage = 1; ; numPage++) { // percorre as paginas encadeadas pelo caracter special
+        // paginas alem do trecho mapeado (arquivo que cresceu depois do
+        // mapeamento) sao lidas pelo buffer pool
+        pinned = map == NULL || (size_t)(numPage + 1) * PAGE_SIZE > mapSize;
+        if(pinned)
+            page = pin_page(tableName, numPage); // pagina da tabela no buffer pool, lida do disco so se faltar
+        else
+            page = map + (size_t)numPage * PAGE_SIZE;
 
-    item items;
-    fread(&head.memFree, sizeof(int), 1, page); // verifica o espaço disponivel da pagina
-    fread(&head.next, sizeof(int), 1, page); // verifica onde termina a pagina
-    fread(&head.qtdItems, sizeof(int), 1, page); // verifica o numero de registros da pagina
+        // a pagina inteira ja esta em memoria e os slots sao percorridos em sequencia
+        qtdSlots = pageRowCount(page, pageFormat); // verifica o numero de registros da pagina
 
-    //printf("memFree: %d - next: %d - qtdItems: %d\n", head.memFree, head.next, head.qtdItems);
+        // a pagina comprimida eh decodificada inteira uma unica vez
+        if(pageFormat == PAGE_FORMAT_COMPRESSED)
+            rows = decodePage(page, attributes, qtdFields, layout);
 
-    for(int i = 0; i < head.qtdItems; i++) { // laço para percorrer os itens
-        fseek(page, 0, SEEK_SET); // posiciona no inicio da pagina
-        moveItem = sizeof(item) * (i + 1); // define o tamanho de cada registro
-        fseek(page, moveItem, SEEK_SET); // vai para o final do registro 
+        for(int i = 0; i < qtdSlots; i++) { // laço para percorrer os itens
+            readItem.offset = pageRowOffset(page, pageFormat, i); // le o offset do registro
 
-        fread(&readItem.offset, sizeof(int), 1, page); // le o offset do registro
-        fread(&readItem.totalLen, sizeof(int), 1, page); // tamanho total do registro
-        fread(&readItem.writed, sizeof(int), 1, page); // se tem algo escrito naquele registro
+            if(readItem.offset < 0) // slot sem registro gravado
+                continue;
 
-        //printf("offset: %d - totalLen: %d - writed: %d\n", readItem.offset, readItem.totalLen, readItem.writed);
+            printRow(page, pageFormat, attributes, qtdFields, layout, rows, qtdSlots, readItem.offset);
+        }
 
-        if(readItem.writed == 0) // se o writed estiver setado como 0, então naquele registro nada foi escrito ainda
-            continue;
+        free(rows);
+        rows = NULL;
 
-        fseek(page, readItem.offset, SEEK_SET); // posiciona no offset do item
-
-      	// percorre os campos da tabela
-        for(int j = 0; j < qtdFields; j++) {  
-			// se o atributo for char
-          	if(attributes[j].type == 'C') { 
-                charInFile = ' '; // seta a variavel com espaço em branco
-                stopChar = 0; // delimitador indicando se chegou no fim do campo char
-                for(int k = 0; k < attributes[j].size; k++) { //laço para percorer o registro do char
-                    fread(&charInFile, 1, 1, page); 
-                    if(charInFile == '\0') // caracter indicando o final do campo char
-                        stopChar = 1; 
-                    if(!stopChar) // caso nao tenha chegado no fim do arquivo
-                        printf("%c", charInFile); //imprime caracter por caracter
-                }
-                printf("\t"); // imprime tab
-
-          	// se o atributo for int
-            } else if(attributes[j].type == 'I') {
-                fread(&intInFile, sizeof(int), 1, page);
-                printf("%d\t", intInFile);
-            // se o atributo for varchar
-            } else if(attributes[j].type == 'V') {
-                charInFile = ' ';
-              	// printa caracater a caracter até encontrar $, q delimita o fim de varchar
-                do {
-                    fread(&charInFile, 1, 1, page);
-                    if(charInFile != '$')
-                        printf("%c", charInFile);
-                } while(charInFile != '$');
-                printf("\t");
+        special = page[8191]; // le o caracter special no final da pagina
+        if(pinned)
+            unpin_page(tableName, numPage, false); // libera a pagina
+        if(special != '1') // se for igual a 1, significa que ainda existe pagina
+            break;
+    }
+
+    if(map != NULL)
+        unmap_table_file(map, mapSize);
+}
+
+
+/**
+ * Comando "stats <tabela>": quantidade de paginas e registros da tabela e a
+ * taxa de compressao, o tamanho dos registros com os campos no tamanho
+ * declarado dividido pelo tamanho das paginas. Nas tabelas comprimidas
+ * mostra tambem quantas paginas usam cada codificacao em cada campo
+ */
+void tableStats(sql_statement *statement) {
+    char *tableName, special;
+    int qtdFields, pageFormat, rowSize = 0, qtdPages = 0, pos;
+    long qtdRows = 0;
+    int encodings[64][ENCODINGS];
+    unsigned short qtdEncoded;
+    attribute *attributes;
+    tableSchema *schema = statementSchema(statement);
+
+    if(schema == NULL)
+        return;
+
+    tableName = schema->tableName;
+    qtdFields = schema->qtdFields;
+    pageFormat = schema->pageFormat;
+    attributes = schema->attributes;
+    memset(encodings, 0, sizeof(encodings));
+    for(int j = 0; j < qtdFields; j++)
+        rowSize += attributes[j].size;
+
+    for(int numPage = 1; ; numPage++) {
+        char *page = pin_page(tableName, numPage);
+
+        qtdPages++;
+        qtdRows += pageRowCount(page, pageFormat);
+
+        // a primeira codificacao de cada campo eh achada pelo tamanho das anteriores
+        if(pageFormat == PAGE_FORMAT_COMPRESSED) {
+            memcpy(&qtdEncoded, page + 2, 2);
+            char *column = malloc((size_t)(qtdEncoded > 0 ? qtdEncoded : 1) * rowSize);
+            pos = 6;
+            for(int j = 0; j < qtdFields && qtdEncoded > 0; j++) {
+                encodings[j][(int)page[pos]]++;
+                pos += decode_column(page + pos, attributes[j].type, attributes[j].size, qtdEncoded, column);
             }
+            free(column);
         }
-        printf("\n");
+
+        special = page[8191];
+        unpin_page(tableName, numPage, false);
+        if(special != '1')
+            break;
     }
-    fseek(page, 8191, SEEK_SET); //posiciona no final do arquivo 
-    fread(&special, 1, 1, page); // le o caracter special
-    if(special == '1') { // se for igual a 1, significa que ainda existe pagina
-        numPage++; 
-        selectFrom(sql, numPage); //continua o select na(s) proxima(s) pagina(s)
-    } else
-        fclose(page); // fecha a pagina
-}
 
+    printf("Table %s: %d pages, %ld rows\n", tableName, qtdPages, qtdRows);
+    printf("Rows: %ld bytes, pages: %ld bytes, ratio %.2f\n", qtdRows * rowSize, (long)qtdPages * PAGE_SIZE,
+        (double)(qtdRows * rowSize) / ((double)qtdPages * PAGE_SIZE));
 
+    for(int j = 0; j < qtdFields && pageFormat == PAGE_FORMAT_COMPRESSED; j++) {
+        printf("%s:", attributes[j].name);
+        for(int e = 0; e < ENCODINGS; e++)
+            if(encodings[j][e] > 0)
+                printf(" %s %d", encoding_name(e), encodings[j][e]);
+        printf("\n");
+    }
+}
 
+/**
+ * Uso: out [-b KB] [-u], onde KB eh a memoria do buffer pool das paginas e
+ * -u confirma os inserts sem esperar o fsync do wal.log (sem garantia de
+ * durabilidade se a maquina cair)
+ */
+int main(int argc, char *argv[]) {
+    char *sql = NULL, error[200];
+    size_t sqlSize = 0;
+    sql_statement statement;
+    buffer_stats stats;
+    wal_stats walStats;
+    size_t poolBytes = BUFFER_POOL_DEFAULT_BYTES;
+    int walMode = WAL_SYNC;
+
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+            poolBytes = (size_t)atoi(argv[++i]) * 1024;
+        else if(strcmp(argv[i], "-u") == 0)
+            walMode = WAL_UNSAFE;
+    }
+    buffer_pool_init(poolBytes);
 
-int main() {
-    char sql[1000], operation[10], attributes[500];
+    // nenhuma pagina eh gravada antes do registro do wal.log que a alterou.
+    // Os inserts do wal.log sao refeitos na abertura e ja vao para os arquivos
+    buffer_pool_before_write(wal_flush);
+    load_node = loadBPTNode; // nos da B+ fora da memoria sao lidos do pk.dat
+    wal_open(walMode);
+    if(wal_replay(redoInsert) > 0 && debug)
+        printf("Inserts refeitos do wal.log\n");
+    checkpointWal();
 
     do {
         printf(">> ");
-        fgets(sql, 1000, stdin);
-        getOp(sql, operation);
-
-        if(strcmp(operation, "create") == 0) {
-            createTable(sql);
-        } else if(strcmp(operation, "insert") == 0) {
-            insertInto(sql, 1);
-        } else if(strcmp(operation, "select") == 0) {
-            selectFrom(sql, 1);
-        } else if(strcmp(operation, "quit") != 0) {
-            printf("Cannot find '%s'\n", operation);
-        }
-    } while(strcmp(operation, "quit") != 0);
+        // o comando pode ter qualquer tamanho. O fim da entrada encerra como quit
+        if(getline(&sql, &sqlSize, stdin) < 0) {
+            statement.type = STATEMENT_QUIT;
+            break;
+        }
+        if(!sql_parse(sql, &statement, error, sizeof(error))) {
+            printf("%s\n", error);
+            sql_free(&statement);
+            statement.type = STATEMENT_EMPTY;
+            continue;
+        }
+
+        if(statement.type == STATEMENT_CREATE) {
+            createTable(&statement);
+        } else if(statement.type == STATEMENT_INSERT) {
+            insertInto(&statement);
+        } else if(statement.type == STATEMENT_SELECT) {
+            selectFrom(&statement);
+        } else if(statement.type == STATEMENT_COPY) {
+            copyFrom(&statement);
+        } else if(statement.type == STATEMENT_PREPARE) {
+            prepareStatement(&statement);
+        } else if(statement.type == STATEMENT_EXECUTE) {
+            executeStatement(&statement);
+        } else if(statement.type == STATEMENT_STATS && statement.table.len > 0) {
+            tableStats(&statement);
+        } else if(statement.type == STATEMENT_STATS) {
+            stats = buffer_pool_stats();
+            printf("Buffer pool: %d frames, %ld hits, %ld misses, %ld evictions, %ld reads, %ld writes, %ld extents\n",
+                buffer_pool_frames(), stats.hits, stats.misses, stats.evictions, stats.reads, stats.writes, stats.extents);
+            walStats = wal_get_stats();
+            printf("WAL: %ld records, %ld commits, %ld syncs, %ld bytes\n",
+                walStats.records, walStats.commits, walStats.syncs, walStats.bytes);
+        }
+        sql_free(&statement);
+
+        // as paginas alteradas ficam no buffer pool, os inserts ja estao no
+        // wal.log. A criacao de tabela nao vai para o wal.log e eh gravada
+        // por um checkpoint, feito tambem apos o copy (que leva todas as
+        // chaves em um registro) e quando o wal.log cresce demais
+        if(statement.type == STATEMENT_CREATE || statement.type == STATEMENT_COPY ||
+            wal_size() >= WAL_CHECKPOINT_BYTES)
+            checkpointWal();
+        trimAllTables();
+    } while(statement.type != STATEMENT_QUIT);
+
+    free(sql);
+    checkpointWal();
 
     return 0;
 }
@@ -0,0 +1,589 @@
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sql.h"
+
+// Characters that end a bare word.
+#define SQL_SYMBOLS "()[],;'=*?"
+
+// TYPES.
+
+/* State of the lexer: the next character to
+ * read and the current token.  The first error
+ * is kept in error and stops the parse.
+ */
+typedef struct lexer
+{
+  const char *pos;
+  sql_token token;
+  char *error;
+  size_t error_size;
+} lexer;
+
+// UTILITIES.
+
+/* Compares a view with a word, ignoring case.
+ */
+bool sql_view_equals(sql_view view, const char *word)
+{
+  int i;
+  for (i = 0; i < view.len; i++)
+    if (word[i] == '\0' ||
+        tolower((unsigned char)view.start[i]) != tolower((unsigned char)word[i]))
+      return false;
+  return word[view.len] == '\0';
+}
+
+/* Copies a view into out as a string, returning
+ * false if it does not fit.
+ */
+bool sql_view_copy(sql_view view, char *out, size_t out_size)
+{
+  if ((size_t)view.len >= out_size)
+    return false;
+  memcpy(out, view.start, view.len);
+  out[view.len] = '\0';
+  return true;
+}
+
+/* Frees what sql_parse allocated, after the
+ * statement is executed (or failed to parse).
+ */
+void sql_free(sql_statement *statement)
+{
+  free(statement->values);
+  statement->values = NULL;
+  statement->values_capacity = 0;
+}
+
+static bool fail(lexer *lex, const char *message, sql_view near)
+{
+  if (lex->error[0] != '\0')
+    return false;
+  if (near.len > 0)
+    snprintf(lex->error, lex->error_size, "%s near '%.*s'", message,
+             near.len, near.start);
+  else
+    snprintf(lex->error, lex->error_size, "%s at the end", message);
+  return false;
+}
+
+// LEXER.
+
+/* A word of digits, with an optional sign, is a
+ * number.  Returns false, leaving it a word, if
+ * it is out of the range of an int.
+ */
+static bool set_number(sql_token *t)
+{
+  const char *digits = t->text.start + (t->text.len > 0 && *t->text.start == '-');
+  const char *end = t->text.start + t->text.len;
+  long number;
+
+  if (digits == end)
+    return true;
+  for (; digits < end; digits++)
+    if (!isdigit((unsigned char)*digits))
+      return true;
+  errno = 0;
+  number = strtol(t->text.start, NULL, 10);
+  if (errno == ERANGE || number < INT_MIN || number > INT_MAX)
+    return false;
+  t->type = TOKEN_NUMBER;
+  t->number = number;
+  return true;
+}
+
+static bool is_word_char(char c)
+{
+  return c != '\0' && !isspace((unsigned char)c) && strchr(SQL_SYMBOLS, c) == NULL;
+}
+
+/* Reads the next token into lex->token.
+ */
+static bool next_token(lexer *lex)
+{
+  const char *p = lex->pos;
+  sql_token *t = &lex->token;
+
+  while (isspace((unsigned char)*p))
+    p++;
+  t->text.start = p;
+  t->number = 0;
+
+  if (*p == '\0')
+  {
+    t->type = TOKEN_END;
+    t->text.len = 0;
+  }
+  else if (*p == '\'')
+  {
+    const char *end = strchr(p + 1, '\'');
+    if (end == NULL)
+    {
+      lex->pos = p;
+      t->text.len = (int)strlen(p);
+      return fail(lex, "Unterminated string", t->text);
+    }
+    t->type = TOKEN_STRING;
+    t->text.start = p + 1;
+    t->text.len = (int)(end - p - 1);
+    p = end + 1;
+  }
+  else if (*p == '?')
+  {
+    t->type = TOKEN_PARAM;
+    t->text.len = 1;
+    p++;
+  }
+  else if (strchr(SQL_SYMBOLS, *p) != NULL)
+  {
+    t->type = TOKEN_SYMBOL;
+    t->text.len = 1;
+    p++;
+  }
+  else
+  {
+    while (is_word_char(*p))
+      p++;
+    t->text.len = (int)(p - t->text.start);
+    t->type = TOKEN_WORD;
+    if (!set_number(t))
+    {
+      lex->pos = p;
+      return fail(lex, "Number out of range", t->text);
+    }
+  }
+  lex->pos = p;
+  return true;
+}
+
+static bool is_symbol(lexer *lex, char c)
+{
+  return lex->token.type == TOKEN_SYMBOL && *lex->token.text.start == c;
+}
+
+static bool is_keyword(lexer *lex, const char *word)
+{
+  return lex->token.type == TOKEN_WORD && sql_view_equals(lex->token.text, word);
+}
+
+// PARSER.
+
+static bool expect_symbol(lexer *lex, char c)
+{
+  char message[32];
+  if (!is_symbol(lex, c))
+  {
+    snprintf(message, sizeof(message), "Expected '%c'", c);
+    return fail(lex, message, lex->token.text);
+  }
+  return next_token(lex);
+}
+
+static bool expect_keyword(lexer *lex, const char *word)
+{
+  char message[64];
+  if (!is_keyword(lex, word))
+  {
+    snprintf(message, sizeof(message), "Expected '%s'", word);
+    return fail(lex, message, lex->token.text);
+  }
+  return next_token(lex);
+}
+
+static bool parse_name(lexer *lex, sql_view *name)
+{
+  if (lex->token.type != TOKEN_WORD)
+    return fail(lex, "Expected a name", lex->token.text);
+  *name = lex->token.text;
+  return next_token(lex);
+}
+
+static bool parse_number(lexer *lex, long *number)
+{
+  if (lex->token.type != TOKEN_NUMBER)
+    return fail(lex, "Expected a number", lex->token.text);
+  *number = lex->token.number;
+  return next_token(lex);
+}
+
+/* TYPE NAME [pk [ai]], with the size of char
+ * and varchar in [ ] or ( ).
+ */
+static bool parse_column(lexer *lex, sql_column *column)
+{
+  long size = sizeof(int);
+  sql_view size_text;
+  char close;
+
+  if (is_keyword(lex, "int"))
+    column->type = 'I';
+  else if (is_keyword(lex, "char"))
+    column->type = 'C';
+  else if (is_keyword(lex, "varchar"))
+    column->type = 'V';
+  else
+    return fail(lex, "Expected int, char or varchar", lex->token.text);
+  if (!next_token(lex))
+    return false;
+
+  if (column->type != 'I')
+  {
+    if (!is_symbol(lex, '[') && !is_symbol(lex, '('))
+      return fail(lex, "Expected the size", lex->token.text);
+    close = is_symbol(lex, '[') ? ']' : ')';
+    if (!next_token(lex))
+      return false;
+    size_text = lex->token.text;
+    if (!parse_number(lex, &size) || !expect_symbol(lex, close))
+      return false;
+    if (size <= 0 || size > 0x7FFF)
+      return fail(lex, "Invalid size", size_text);
+  }
+  column->size = (int)size;
+
+  if (!parse_name(lex, &column->name))
+    return false;
+  column->pk = is_keyword(lex, "pk");
+  if (column->pk && !next_token(lex))
+    return false;
+  column->ai = column->pk && is_keyword(lex, "ai");
+  if (column->ai && !next_token(lex))
+    return false;
+  return true;
+}
+
+static bool parse_create(lexer *lex, sql_statement *statement)
+{
+  sql_table_options *options = &statement->options;
+  long number;
+
+  statement->type = STATEMENT_CREATE;
+  if (!expect_keyword(lex, "table") || !parse_name(lex, &statement->table) ||
+      !expect_symbol(lex, '('))
+    return false;
+
+  do
+  {
+    if (statement->num_columns == SQL_MAX_COLUMNS)
+      return fail(lex, "Too many columns", lex->token.text);
+    if (!parse_column(lex, &statement->columns[statement->num_columns++]))
+      return false;
+  } while (is_symbol(lex, ',') && next_token(lex));
+  if (!expect_symbol(lex, ')'))
+    return false;
+
+  while (lex->token.type == TOKEN_WORD)
+  {
+    if (is_keyword(lex, "order"))
+    {
+      if (!next_token(lex))
+        return false;
+      if (is_keyword(lex, "auto"))
+      {
+        options->order_auto = true;
+        options->has_order = true;
+        if (!next_token(lex))
+          return false;
+        if (lex->token.type == TOKEN_NUMBER)
+        {
+          if (!parse_number(lex, &number))
+            return false;
+          options->node_size = (int)number;
+        }
+        continue;
+      }
+      if (!parse_number(lex, &number))
+        return false;
+      options->order = (int)number;
+      options->has_order = true;
+      continue;
+    }
+    if (is_keyword(lex, "bloom"))
+      options->bloom = true;
+    else if (is_keyword(lex, "pax"))
+      options->pax = true;
+    else if (is_keyword(lex, "compress"))
+      options->compress = true;
+    else
+      return fail(lex, "Unknown table option", lex->token.text);
+    if (!next_token(lex))
+      return false;
+  }
+  return true;
+}
+
+static void add_value(sql_statement *statement, int index, sql_token *token)
+{
+  if (index == statement->values_capacity)
+  {
+    statement->values_capacity = index > 0 ? 2 * index : SQL_MAX_COLUMNS;
+    statement->values = realloc(statement->values,
+                                statement->values_capacity * sizeof(sql_token));
+    if (statement->values == NULL)
+    {
+      perror("Statement values.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  statement->values[index] = *token;
+}
+
+/* (VALUE, ...), added as a new row.  Every row
+ * has as many values as the first one.  The ?
+ * are counted in params when they are allowed.
+ */
+static bool parse_row(lexer *lex, sql_statement *statement, bool params)
+{
+  sql_view start = lex->token.text;
+  int count = 0, total;
+  char message[48];
+
+  if (!expect_symbol(lex, '('))
+    return false;
+
+  do
+  {
+    total = statement->num_rows * statement->num_values + count;
+    if (lex->token.type == TOKEN_PARAM && params)
+    {
+      if (statement->num_params == SQL_MAX_COLUMNS)
+        return fail(lex, "Too many parameters", lex->token.text);
+      statement->params[statement->num_params++] = total;
+    }
+    else if (lex->token.type != TOKEN_NUMBER && lex->token.type != TOKEN_STRING &&
+             lex->token.type != TOKEN_WORD)
+      return fail(lex, "Expected a value", lex->token.text);
+    if (count == SQL_MAX_COLUMNS ||
+        (statement->num_rows > 0 && count == statement->num_values))
+      return fail(lex, "Too many values", lex->token.text);
+    if (statement->num_rows == 0)
+      statement->num_values++;
+    add_value(statement, total, &lex->token);
+    count++;
+    if (!next_token(lex))
+      return false;
+  } while (is_symbol(lex, ',') && next_token(lex));
+
+  if (count < statement->num_values)
+  {
+    snprintf(message, sizeof(message), "Expected %d values", statement->num_values);
+    return fail(lex, message, start);
+  }
+  statement->num_rows++;
+  return expect_symbol(lex, ')');
+}
+
+static bool parse_insert(lexer *lex, sql_statement *statement)
+{
+  statement->type = STATEMENT_INSERT;
+  if (!expect_keyword(lex, "into") || !parse_name(lex, &statement->table) ||
+      !expect_keyword(lex, "values"))
+    return false;
+
+  do
+  {
+    if (!parse_row(lex, statement, true))
+      return false;
+  } while (is_symbol(lex, ',') && next_token(lex));
+  return true;
+}
+
+/* The statement after as is left unparsed in
+ * body; the caller parses it into the tree it
+ * keeps.
+ */
+static bool parse_prepare(lexer *lex, sql_statement *statement)
+{
+  statement->type = STATEMENT_PREPARE;
+  if (!parse_name(lex, &statement->name))
+    return false;
+  if (!is_keyword(lex, "as"))
+    return fail(lex, "Expected 'as'", lex->token.text);
+
+  statement->body.start = lex->pos;
+  statement->body.len = (int)strlen(lex->pos);
+  lex->pos += statement->body.len;
+  return next_token(lex);
+}
+
+static bool parse_execute(lexer *lex, sql_statement *statement)
+{
+  statement->type = STATEMENT_EXECUTE;
+  if (!parse_name(lex, &statement->name))
+    return false;
+  return !is_symbol(lex, '(') || parse_row(lex, statement, false);
+}
+
+/* The value of where (a number, or ? when
+ * prepared) is kept as the only value, so that
+ * execute binds it as it binds an insert.
+ */
+static bool parse_select(lexer *lex, sql_statement *statement)
+{
+  statement->type = STATEMENT_SELECT;
+  if (!expect_symbol(lex, '*') || !expect_keyword(lex, "from") ||
+      !parse_name(lex, &statement->table))
+    return false;
+  if (!is_keyword(lex, "where"))
+    return true;
+
+  if (!next_token(lex) || !parse_name(lex, &statement->where) ||
+      !expect_symbol(lex, '='))
+    return false;
+  if (lex->token.type == TOKEN_PARAM)
+    statement->params[statement->num_params++] = 0;
+  else if (lex->token.type != TOKEN_NUMBER)
+    return fail(lex, "Expected a number", lex->token.text);
+  add_value(statement, 0, &lex->token);
+  statement->num_rows = 1;
+  statement->num_values = 1;
+  return next_token(lex);
+}
+
+static bool parse_copy(lexer *lex, sql_statement *statement)
+{
+  statement->type = STATEMENT_COPY;
+  if (!parse_name(lex, &statement->table) || !expect_keyword(lex, "from"))
+    return false;
+  if (lex->token.type != TOKEN_STRING && lex->token.type != TOKEN_WORD)
+    return fail(lex, "Expected a file name", lex->token.text);
+  statement->file = lex->token.text;
+  return next_token(lex);
+}
+
+/* Parses one statement of text into statement.
+ * On a syntax error returns false with the
+ * message in error.
+ */
+bool sql_parse(const char *text, sql_statement *statement,
+               char *error, size_t error_size)
+{
+  lexer lex;
+  bool parsed;
+
+  memset(statement, 0, sizeof(sql_statement));
+  lex.pos = text;
+  lex.error = error;
+  lex.error_size = error_size;
+  error[0] = '\0';
+  if (!next_token(&lex))
+    return false;
+
+  if (lex.token.type == TOKEN_END)
+    return true;
+  if (is_keyword(&lex, "create"))
+    parsed = next_token(&lex) && parse_create(&lex, statement);
+  else if (is_keyword(&lex, "insert"))
+    parsed = next_token(&lex) && parse_insert(&lex, statement);
+  else if (is_keyword(&lex, "select"))
+    parsed = next_token(&lex) && parse_select(&lex, statement);
+  else if (is_keyword(&lex, "copy"))
+    parsed = next_token(&lex) && parse_copy(&lex, statement);
+  else if (is_keyword(&lex, "prepare"))
+    parsed = next_token(&lex) && parse_prepare(&lex, statement);
+  else if (is_keyword(&lex, "execute"))
+    parsed = next_token(&lex) && parse_execute(&lex, statement);
+  else if (is_keyword(&lex, "stats"))
+  {
+    statement->type = STATEMENT_STATS;
+    parsed = next_token(&lex) &&
+             (lex.token.type != TOKEN_WORD || parse_name(&lex, &statement->table));
+  }
+  else if (is_keyword(&lex, "quit"))
+  {
+    statement->type = STATEMENT_QUIT;
+    parsed = next_token(&lex);
+  }
+  else
+  {
+    snprintf(error, error_size, "Cannot find '%.*s'", lex.token.text.len,
+             lex.token.text.start);
+    return false;
+  }
+  // a lexer error inside a list ends it early
+  if (!parsed || error[0] != '\0')
+    return false;
+
+  if (is_symbol(&lex, ';') && !next_token(&lex))
+    return false;
+  if (lex.token.type != TOKEN_END)
+    return fail(&lex, "Unexpected text", lex.token.text);
+  return true;
+}
+
+// CSV.
+
+/* Reads the line of a CSV file at *pos (before
+ * end) into values and moves *pos to the next
+ * line.  Fields are separated by commas, with
+ * the blanks around them ignored; a field
+ * between double quotes (which it cannot
+ * contain) may hold commas and is a
+ * TOKEN_STRING, a field of digits a
+ * TOKEN_NUMBER (a word if out of the range of
+ * an int).  Returns the number of fields,
+ * 0 for a blank line or -1 if there are more
+ * than max_values.
+ */
+int sql_csv_line(const char **pos, const char *end,
+                 sql_token values[], int max_values)
+{
+  const char *p = *pos, *line_end, *field_end, *close;
+  sql_token *t;
+  int count = 0;
+
+  line_end = memchr(p, '\n', end - p);
+  if (line_end == NULL)
+    line_end = end;
+  *pos = line_end < end ? line_end + 1 : end;
+
+  while (p < line_end && isspace((unsigned char)*p))
+    p++;
+  if (p == line_end)
+    return 0;
+
+  for (;;)
+  {
+    if (count == max_values)
+      return -1;
+    t = &values[count++];
+    t->number = 0;
+
+    while (p < line_end && (*p == ' ' || *p == '\t'))
+      p++;
+    close = p < line_end && *p == '"' ? memchr(p + 1, '"', line_end - p - 1) : NULL;
+    if (close != NULL)
+    {
+      t->type = TOKEN_STRING;
+      t->text.start = p + 1;
+      t->text.len = (int)(close - p - 1);
+      p = close + 1;
+      field_end = memchr(p, ',', line_end - p);
+      if (field_end == NULL)
+        field_end = line_end;
+    }
+    else
+    {
+      field_end = memchr(p, ',', line_end - p);
+      if (field_end == NULL)
+        field_end = line_end;
+      t->type = TOKEN_WORD;
+      t->text.start = p;
+      t->text.len = (int)(field_end - p);
+      while (t->text.len > 0 && isspace((unsigned char)p[t->text.len - 1]))
+        t->text.len--;
+      set_number(t);
+    }
+
+    if (field_end == line_end)
+      return count;
+    p = field_end + 1;
+  }
+}
@@ -0,0 +1,155 @@
+/*
+ *  sql.h
+ *
+ *  Lexer and parser of the statements.
+ *
+ *  A statement is read in a single pass into a
+ *  sql_statement (its syntax tree), which the
+ *  executor consumes directly.  Names and values
+ *  are views into the text of the statement, not
+ *  copies, so the text must outlive the tree and
+ *  has no length limit.
+ *
+ *  Statements:
+ *
+ *  create table NAME (TYPE NAME [pk [ai]], ...)
+ *      [order N | order auto [BYTES]] [bloom]
+ *      [pax | compress]
+ *    where TYPE is int, char[N] or varchar[N]
+ *  insert into NAME values (VALUE, ...), ...
+ *  select * from NAME [where NAME = NUMBER]
+ *  stats [NAME]
+ *  copy NAME from 'FILE'
+ *  prepare NAME as STATEMENT
+ *  execute NAME [(VALUE, ...)]
+ *  quit
+ *
+ *  Keywords are case insensitive.  A value is a
+ *  number, a string between single quotes or a
+ *  bare word (any run of characters other than
+ *  blanks and ( ) [ ] , ; ' = * ?).  In a
+ *  prepared insert or select a value can be ?, a
+ *  parameter given by each execute, in order.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Most columns of a table (and values in a row of an insert).
+#define SQL_MAX_COLUMNS 64
+
+// TYPES.
+
+/* A piece of the text of a statement.
+ */
+typedef struct sql_view
+{
+  const char *start;
+  int len;
+} sql_view;
+
+typedef enum token_type
+{
+  TOKEN_END,
+  TOKEN_WORD,
+  TOKEN_NUMBER,
+  TOKEN_STRING,
+  TOKEN_SYMBOL,
+  TOKEN_PARAM
+} token_type;
+
+/* A token.  number is the value of a
+ * TOKEN_NUMBER; a TOKEN_STRING is seen without
+ * its quotes.
+ */
+typedef struct sql_token
+{
+  token_type type;
+  sql_view text;
+  long number;
+} sql_token;
+
+typedef enum statement_type
+{
+  STATEMENT_EMPTY,
+  STATEMENT_CREATE,
+  STATEMENT_INSERT,
+  STATEMENT_SELECT,
+  STATEMENT_STATS,
+  STATEMENT_COPY,
+  STATEMENT_PREPARE,
+  STATEMENT_EXECUTE,
+  STATEMENT_QUIT
+} statement_type;
+
+/* A column of create table.  type is 'I', 'C'
+ * or 'V' and size its bytes (the declared
+ * length of a char or varchar).
+ */
+typedef struct sql_column
+{
+  char type;
+  int size;
+  sql_view name;
+  bool pk;
+  bool ai;
+} sql_column;
+
+/* Options of create table.  has_order says
+ * whether the order was given, as order or as
+ * order_auto, the largest order whose node fits
+ * in node_size bytes (0 when not given).
+ */
+typedef struct sql_table_options
+{
+  bool has_order;
+  int order;
+  bool order_auto;
+  int node_size;
+  bool bloom;
+  bool pax;
+  bool compress;
+} sql_table_options;
+
+/* Syntax tree of a statement.  table is empty
+ * for a plain stats.  The values of an insert
+ * are num_rows rows of num_values each, one row
+ * after the other; they are allocated, see
+ * sql_free.  prepare and execute name the
+ * prepared statement; prepare keeps its text in
+ * body, to be parsed on its own, and execute its
+ * parameters in values.  params are the
+ * positions of the ? among the values.  file is
+ * the CSV file of copy.  where is the field of
+ * select * from NAME where NAME = NUMBER, whose
+ * number is the only value.
+ */
+typedef struct sql_statement
+{
+  statement_type type;
+  sql_view table;
+  int num_columns;
+  sql_column columns[SQL_MAX_COLUMNS];
+  sql_table_options options;
+  int num_rows;
+  int num_values;
+  sql_token *values;
+  int values_capacity;
+  int num_params;
+  int params[SQL_MAX_COLUMNS];
+  sql_view name;
+  sql_view body;
+  sql_view file;
+  sql_view where;
+} sql_statement;
+
+// FUNCTION PROTOTYPES.
+
+bool sql_parse(const char *text, sql_statement *statement,
+               char *error, size_t error_size);
+void sql_free(sql_statement *statement);
+int sql_csv_line(const char **pos, const char *end,
+                 sql_token values[], int max_values);
+bool sql_view_equals(sql_view view, const char *word);
+bool sql_view_copy(sql_view view, char *out, size_t out_size);
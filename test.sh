@@ -0,0 +1,69 @@
+# Testes de regressao: compila o programa e roda os comandos de cada teste
+# em um diretorio temporario, conferindo a saida
+
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+gcc -std=c99 -O2 bpt.h bpt.c bloom.h bloom.c bufferpool.h bufferpool.c compress.h compress.c wal.h wal.c sql.h sql.c primarykey.c -o "$DIR/out" -lpthread || exit 1
+gcc -std=c99 -O2 bpt.h bpt.c bpt_test.c -o "$DIR/bpt_test" || exit 1
+
+cd "$DIR"
+failed=0
+
+check() {
+    if [ "$2" = "$3" ]; then
+        echo "ok   $1"
+    else
+        echo "FAIL $1: expected $2, got $3"
+        failed=1
+    fi
+}
+
+# arvores montadas por insert_batch, insert_sequential e bulk_load, e lidas
+# de volta apos sair da memoria, comparadas com as montadas por insert()
+./bpt_test
+check "b+ tree insertion paths against insert()" 0 $?
+
+# select de uma tabela maior que um extent do data.dat, na mesma execucao
+# dos inserts (paginas ainda nao gravadas quando o arquivo eh mapeado)
+rows=$( (echo "create table scan (int a pk, char[100] b, int c)"
+         for i in $(seq 1 5600); do echo "insert into scan values ($i, row$i, $i)"; done
+         echo "select * from scan"
+         echo quit) | ./out -u | grep -c "^[0-9]")
+check "scan larger than an extent" 5600 "$rows"
+
+rows=$(printf "select * from scan\nquit\n" | ./out | grep -c "^[0-9]")
+check "scan after reopening" 5600 "$rows"
+
+# indice com mais nos que os mantidos em memoria: os nos saem da memoria
+# apos os comandos e sao lidos de novo do pk.dat quando visitados
+keys=$(seq 1 12000 | shuf --random-source=<(yes))
+rows=$( (echo "create table lazy (int a pk, int b) order 3"
+         echo "$keys" | paste -d' ' - - - - - - - - - - | \
+             awk '{ s = "insert into lazy values"; for (i = 1; i <= NF; i++) s = s (i > 1 ? "," : "") " (" $i ", " $i ")"; print s }'
+         echo "select * from lazy"
+         echo quit) | ./out -u | grep -c "^[0-9]")
+check "index larger than the node cache" 12000 "$rows"
+
+found=$( (echo "prepare q as select * from lazy where a = ?"
+          echo "$keys" | awk '{ print "execute q (" $1 ")" }'
+          echo quit) | ./out | grep -c "^[0-9]")
+check "lookups after reopening a large index" 12000 "$found"
+
+# o ai de um copy numera os registros como o insert das mesmas linhas: o
+# registro maior que uma pagina vazia nao consome um valor
+big=$(printf '%9000s' | tr ' ' x)
+printf "a\n%s\nb\n%s\nc\n" "$big" "$big" > ai.csv
+inserted=$( (echo "create table aiins (int a pk ai, varchar[9000] b)"
+             while read -r line; do echo "insert into aiins values ($line)"; done < ai.csv
+             echo "insert into aiins values (next)"
+             echo "select * from aiins"
+             echo quit) | ./out | grep "^[0-9]" | tr '\t\n' ' ')
+copied=$( (echo "create table aicopy (int a pk ai, varchar[9000] b)"
+           echo "copy aicopy from ai.csv"
+           echo "insert into aicopy values (next)"
+           echo "select * from aicopy"
+           echo quit) | ./out | grep "^[0-9]" | tr '\t\n' ' ')
+check "ai values of copy and insert" "$inserted" "$copied"
+
+exit $failed
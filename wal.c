@@ -0,0 +1,230 @@
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "wal.h"
+
+// GLOBALS.
+
+static int fd = -1;
+static int sync_mode = WAL_SYNC;
+
+// Records appended and not yet written.
+static char *buffer = NULL;
+static size_t used = 0, capacity = 0;
+
+/* Positions in the log: appended_lsn is the end
+ * of the last record appended, durable_lsn the
+ * end of what is written (and synced).
+ */
+static long appended_lsn = 0;
+static long durable_lsn = 0;
+static long file_size = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static wal_stats stats;
+
+// FUNCTION DEFINITIONS.
+
+// FNV-1a over the payload of a record.
+static uint32_t checksum(const char *data, int len)
+{
+  uint32_t h = 2166136261u;
+  int i;
+  for (i = 0; i < len; i++)
+  {
+    h ^= (unsigned char)data[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static void write_all(const char *data, size_t len)
+{
+  ssize_t put;
+  while (len > 0)
+  {
+    put = write(fd, data, len);
+    if (put < 0)
+    {
+      perror("Write-ahead log write.");
+      exit(EXIT_FAILURE);
+    }
+    data += put;
+    len -= (size_t)put;
+  }
+}
+
+/* Opens (or creates) wal.log.  Its records are
+ * not replayed here, see wal_replay.
+ */
+void wal_open(int mode)
+{
+  sync_mode = mode;
+  fd = open(WAL_FILE, O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (fd < 0)
+  {
+    perror("Write-ahead log open.");
+    exit(EXIT_FAILURE);
+  }
+  file_size = lseek(fd, 0, SEEK_END);
+}
+
+/* Appends a record, returning the LSN to commit
+ * for it to be durable.
+ */
+long wal_append(const char *data, int len)
+{
+  uint32_t frame[2];
+  size_t need;
+  long lsn;
+
+  frame[0] = (uint32_t)len;
+  frame[1] = checksum(data, len);
+
+  pthread_mutex_lock(&lock);
+  need = used + sizeof(frame) + (size_t)len;
+  if (need > capacity)
+  {
+    capacity = need > 2 * capacity ? need : 2 * capacity;
+    buffer = realloc(buffer, capacity);
+    if (buffer == NULL)
+    {
+      perror("Write-ahead log buffer.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  memcpy(buffer + used, frame, sizeof(frame));
+  memcpy(buffer + used + sizeof(frame), data, len);
+  used = need;
+  appended_lsn += (long)sizeof(frame) + len;
+  lsn = appended_lsn;
+  stats.records++;
+  stats.bytes += (long)sizeof(frame) + len;
+  pthread_mutex_unlock(&lock);
+  return lsn;
+}
+
+/* Writes (and syncs) every record appended and
+ * not yet written.  Called with the lock held.
+ */
+static void write_appended(void)
+{
+  if (durable_lsn == appended_lsn)
+    return;
+  write_all(buffer, used);
+  if (sync_mode == WAL_SYNC)
+  {
+    if (fdatasync(fd) != 0)
+      perror("Write-ahead log sync.");
+    stats.syncs++;
+  }
+  file_size += (long)used;
+  used = 0;
+  durable_lsn = appended_lsn;
+}
+
+/* Returns once the record ending at lsn is
+ * durable, writing it with every record
+ * appended before it in a single fsync.
+ */
+void wal_commit(long lsn)
+{
+  pthread_mutex_lock(&lock);
+  stats.commits++;
+  if (durable_lsn < lsn)
+    write_appended();
+  pthread_mutex_unlock(&lock);
+}
+
+/* Makes every record appended durable, before a
+ * page they changed is written.
+ */
+void wal_flush(void)
+{
+  pthread_mutex_lock(&lock);
+  write_appended();
+  pthread_mutex_unlock(&lock);
+}
+
+// Bytes of the log, written or not.
+long wal_size(void)
+{
+  long size;
+  pthread_mutex_lock(&lock);
+  size = file_size + (long)used;
+  pthread_mutex_unlock(&lock);
+  return size;
+}
+
+/* Calls apply with each record of wal.log, in
+ * order, and returns how many there were.  A
+ * record cut short or with a wrong checksum
+ * ends the log and is cut off the file.
+ */
+int wal_replay(void (*apply)(const char *data, int len))
+{
+  uint32_t frame[2];
+  char *data = NULL;
+  size_t data_capacity = 0;
+  off_t pos = 0;
+  int count = 0;
+
+  while (pread(fd, frame, sizeof(frame), pos) == (ssize_t)sizeof(frame))
+  {
+    if ((long)frame[0] > file_size)
+      break;
+    if (frame[0] > data_capacity)
+    {
+      data_capacity = frame[0];
+      data = realloc(data, data_capacity);
+      if (data == NULL)
+      {
+        perror("Write-ahead log replay.");
+        exit(EXIT_FAILURE);
+      }
+    }
+    if (pread(fd, data, frame[0], pos + (off_t)sizeof(frame)) != (ssize_t)frame[0] ||
+        checksum(data, (int)frame[0]) != frame[1])
+      break;
+    apply(data, (int)frame[0]);
+    pos += (off_t)sizeof(frame) + frame[0];
+    count++;
+  }
+  free(data);
+
+  if (pos < file_size && ftruncate(fd, pos) == 0)
+    file_size = pos;
+  return count;
+}
+
+/* Empties wal.log, once every change it holds
+ * is in the files of the tables (checkpoint).
+ */
+void wal_truncate(void)
+{
+  pthread_mutex_lock(&lock);
+  write_appended();
+  if (ftruncate(fd, 0) != 0)
+    perror("Write-ahead log truncate.");
+  else
+    file_size = 0;
+  if (sync_mode == WAL_SYNC)
+    fdatasync(fd);
+  pthread_mutex_unlock(&lock);
+}
+
+wal_stats wal_get_stats(void)
+{
+  wal_stats copy;
+  pthread_mutex_lock(&lock);
+  copy = stats;
+  pthread_mutex_unlock(&lock);
+  return copy;
+}
@@ -0,0 +1,60 @@
+/*
+ *  wal.h
+ *
+ *  Write-ahead log of the changes to the tables,
+ *  kept in wal.log in the directory of the tables.
+ *
+ *  A change is appended as an opaque record and
+ *  made durable by committing the position (LSN)
+ *  appended returned.  Pages changed by a record
+ *  may only reach their files after the record,
+ *  so the buffer pool calls wal_flush before
+ *  writing a dirty page.
+ *
+ *  A commit writes every record appended so far
+ *  and syncs the file once, so a statement that
+ *  appends several records (a multi-row insert,
+ *  a copy) and commits the last pays for a
+ *  single fsync.
+ *
+ *  Each record is framed by its length and a
+ *  checksum, so a record torn by a crash ends
+ *  the log when it is replayed.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define WAL_FILE "wal.log"
+
+// Size of wal.log that calls for a checkpoint.
+#define WAL_CHECKPOINT_BYTES (16L * 1024 * 1024)
+
+// Durability of a commit.
+#define WAL_UNSAFE 0 // written to the file, no fsync
+#define WAL_SYNC 1   // written and synced (fdatasync)
+
+// TYPES.
+
+/* Counters of the log.  syncs below commits are
+ * commits whose records were already durable.
+ */
+typedef struct wal_stats
+{
+  long records;
+  long commits;
+  long syncs;
+  long bytes;
+} wal_stats;
+
+// FUNCTION PROTOTYPES.
+
+void wal_open(int mode);
+long wal_append(const char *data, int len);
+void wal_commit(long lsn);
+void wal_flush(void);
+long wal_size(void);
+int wal_replay(void (*apply)(const char *data, int len));
+void wal_truncate(void);
+wal_stats wal_get_stats(void);